@@ -1,298 +1,817 @@
-#ifndef __KEYCHRON_V6_HPP__
-#define __KEYCHRON_V6_HPP__
-
-#include "../keyboard.hpp"
-#include "../../util/bytes.hpp"
-
-#include <hidapi/hidapi.h>
-#include <cmath>
-
-#include <algorithm>
-
-#include <map>
-#include <list>
-#include <vector>
-
-const size_t KeychronV6PayloadLength = 32;
-const size_t KeychronV6TotalLEDs = 108;
-
-const std::vector<std::vector<uint8_t>> KeychronV6LEDS = {
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-};
-
-const uint8_t KeychronV6Cols = 22;
-const uint8_t KeychronV6Rows = 6;
-
-enum KeychronV6PacketCommands {
-    id_get_protocol_version                 = 0x01, // always 0x01
-    id_get_keyboard_value                   = 0x02,
-    id_set_keyboard_value                   = 0x03,
-    id_dynamic_keymap_get_keycode           = 0x04,
-    id_dynamic_keymap_set_keycode           = 0x05,
-    id_dynamic_keymap_reset                 = 0x06,
-    id_custom_set_value                     = 0x07,
-    id_custom_get_value                     = 0x08,
-    id_custom_save                          = 0x09,
-    id_eeprom_reset                         = 0x0A,
-    id_bootloader_jump                      = 0x0B,
-    id_dynamic_keymap_macro_get_count       = 0x0C,
-    id_dynamic_keymap_macro_get_buffer_size = 0x0D,
-    id_dynamic_keymap_macro_get_buffer      = 0x0E,
-    id_dynamic_keymap_macro_set_buffer      = 0x0F,
-    id_dynamic_keymap_macro_reset           = 0x10,
-    id_dynamic_keymap_get_layer_count       = 0x11,
-    id_dynamic_keymap_get_buffer            = 0x12,
-    id_dynamic_keymap_set_buffer            = 0x13,
-    id_dynamic_keymap_get_encoder           = 0x14,
-    id_dynamic_keymap_set_encoder           = 0x15,
-    id_unhandled                            = 0xFF,
-};
-
-enum KeychronV6PacketChannels {
-    id_custom_channel            = 0,
-    id_qmk_backlight_channel     = 1,
-    id_qmk_rgblight_channel      = 2,
-    id_qmk_rgb_matrix_channel    = 3,
-    id_qmk_audio_channel         = 4,
-    id_custom_set_effect_channel = 5,
-    id_custom_array_led_channel  = 6,
-    id_custom_single_led_channel = 7,
-    id_custom_single_col_channel = 8,
-    id_custom_array_col_channel  = 9,
-    id_custom_draw_channel       = 10,
-};
-
-class KeychronV6 : public Keyboard {
-public:
-    std::map<uint8_t, time_t> keypressStartTimes;
-
-private:
-    std::list<uint16_t> SCAN_TO_KEY = {
-        // 0xFF is ignored
-        { KEY_ESC },  { KEY_F1 }, { KEY_F2 }, { KEY_F3 }, { KEY_F4 },  { KEY_F5 }, { KEY_F6 }, { KEY_F7 }, { KEY_F8 },  { KEY_F9 }, { KEY_F10 }, { KEY_F11 }, { KEY_F12 },    { KEY_PRINT }, { KEY_SCROLLLOCK }, { 0xFF },    { 0xFF }, { 0xFF }, { 0xFF }, { 0xFF },
-        { KEY_GRAVE }, { KEY_1 }, { KEY_2 }, { KEY_3 }, { KEY_4 }, { KEY_5 }, { KEY_6 }, { KEY_7 }, { KEY_8 }, { KEY_9 }, { KEY_0 }, { KEY_MINUS }, { KEY_EQUAL }, { KEY_BACKSPACE },   { KEY_INSERT }, { KEY_HOME }, { KEY_PAGEUP },   { KEY_NUMLOCK }, { KEY_KPSLASH }, { KEY_KPASTERISK }, { KEY_KPMINUS },
-        { KEY_TAB }, { KEY_Q }, { KEY_W }, { KEY_E }, { KEY_R }, { KEY_T }, { KEY_Y }, { KEY_U }, { KEY_I }, { KEY_O }, { KEY_P }, { KEY_LEFTBRACE }, { KEY_RIGHTBRACE }, { KEY_BACKSLASH }, { KEY_DELETE }, { KEY_END }, { KEY_PAGEDOWN }, { KEY_KP7 }, { KEY_KP8 }, { KEY_KP9 },
-        { KEY_CAPSLOCK }, { KEY_A }, { KEY_S }, { KEY_D }, { KEY_F }, { KEY_G }, { KEY_H }, { KEY_J }, { KEY_K }, { KEY_L }, { KEY_SEMICOLON }, { KEY_APOSTROPHE }, { KEY_ENTER }, { KEY_KP4 }, { KEY_KP5 }, { KEY_KP6 }, { KEY_KPPLUS },
-        { KEY_LEFTSHIFT }, { KEY_Z }, { KEY_X }, { KEY_C }, { KEY_V }, { KEY_B }, { KEY_N }, { KEY_M }, { KEY_COMMA }, { KEY_DOT }, { KEY_SLASH }, { KEY_RIGHTSHIFT }, { KEY_UP }, { KEY_KP1 }, { KEY_KP2 }, { KEY_KP3 },
-        { KEY_LEFTCTRL }, { KEY_LEFTMETA }, { KEY_LEFTALT }, { KEY_SPACE }, { KEY_RIGHTALT }, { KEY_RIGHTMETA }, { 0xFF }, { KEY_RIGHTCTRL }, { KEY_LEFT }, { KEY_DOWN }, { KEY_RIGHT }, { KEY_KP0 }, { KEY_KPDOT }, { KEY_KPENTER }
-    };
-
-    const uint8_t DRAW_PACKET[KeychronV6PayloadLength + 1] = { 0x00, id_custom_set_value, id_custom_draw_channel };
-    std::map<uint8_t, RGB> framebuffer;
-    std::map<uint8_t, RGB> emptyFramebuffer;
-
-    std::map<uint8_t, uint8_t> dimmedKeysValues;
-    std::map<uint8_t, RGB> dimmedKeysRGB;
-
-
-    void onDeviceEvent(struct libevdev* device, struct input_event* event) {
-        // printf(
-        //     "Event: %s %s %d, %u\n",
-        //     libevdev_event_type_get_name(event->type),
-        //     libevdev_event_code_get_name(event->type, event->code),
-        //     event->value,
-        //     event->code
-        // );
-
-        if(event->type != EV_KEY) return;
-
-        switch(event->type) {
-        case EV_KEY: {
-            switch(event->value) {
-            case 1: {
-                keypressStartTimes[event->code] = time(NULL);
-            }
-            case 2: {
-                auto it = std::find(SCAN_TO_KEY.begin(), SCAN_TO_KEY.end(), event->code);
-                if(it == SCAN_TO_KEY.end()) break;
-
-                size_t idx = std::distance(SCAN_TO_KEY.begin(), it);
-
-                dimmedKeysValues[idx] = 10;
-                break;
-            }
-            case 0:
-                auto it = keypressStartTimes.find(event->code);
-                if(it == keypressStartTimes.end()) break;
-
-                keypressStartTimes.erase(it);
-                break;
-            }
-
-            break;
-        }
-        default: break;
-        }
-    }
-
-public:
-    KeychronV6() : Keyboard(0x3434, 0x0361, 0xFF60, 0x0061, KeychronV6LEDS, [this]() -> void {
-        this->set_effect();
-    }) {
-        emptyFramebuffer = {};
-        for(uint8_t col = 0; col < KeychronV6Cols; col++) {
-            emptyFramebuffer[col] = { 0x00, 0x00, 0x00 };
-        }
-
-        framebuffer = emptyFramebuffer;
-    }
-
-    virtual ~KeychronV6() {}
-
-
-    uint8_t getCols() { return KeychronV6Cols; }
-    uint8_t getRows() { return KeychronV6Rows; }
-
-    void set_col(uint8_t col, RGB rgb) {
-        if(col >= KeychronV6Cols) return;
-
-        framebuffer[col] = rgb;
-    }
-
-    void set_led(uint8_t col, RGB rgb) {
-        if(col >= KeychronV6Cols) return;
-
-        framebuffer[col] = rgb;
-    }
-
-    void set_effect() {
-        if(!device) return;
-
-        deviceMutex.lock();
-
-        uint8_t payload[KeychronV6PayloadLength + 1];
-        std::memset(payload, 0x00, KeychronV6PayloadLength + 1);
-
-        payload[1] = KeychronV6PacketCommands::id_custom_set_value;
-        payload[2] = KeychronV6PacketChannels::id_custom_set_effect_channel;
-
-        hid_write(device, payload, (KeychronV6PayloadLength + 1) * sizeof(uint8_t));
-
-        deviceMutex.unlock();
-    }
-
-
-    std::vector<uint8_t> getUnformattedPayload(std::map<uint8_t, RGB> buffer) {
-        size_t unformattedPayloadLength = (buffer.size() * (sizeof(RGB) + 1));
-        std::vector<uint8_t> unformattedPayload(unformattedPayloadLength);
-
-        size_t i = 0;
-        for(std::pair<uint8_t, RGB> pair : buffer) {
-            unformattedPayload[i++] = pair.first;
-            unformattedPayload[i++] = pair.second.red;
-            unformattedPayload[i++] = pair.second.green;
-            unformattedPayload[i++] = pair.second.blue;
-        }
-
-        return unformattedPayload;
-    }
-
-    std::vector<std::vector<uint8_t>> getPayloads(std::vector<uint8_t> unformattedPayload, uint8_t command, uint8_t channel) {
-        size_t totalPayloads = std::ceil((double)(unformattedPayload.size()) / (double)(KeychronV6PayloadLength - 4));
-        std::vector<std::vector<uint8_t>> payloads(totalPayloads);
-
-        long long bytesLeft = (long long)unformattedPayload.size();
-
-        for(size_t i = 0; i < totalPayloads; i++) {
-            if((size_t)bytesLeft < KeychronV6PayloadLength - 3) {
-                payloads[i] = std::vector<uint8_t>(bytesLeft + 4, 0x00);
-            }
-            else {
-                payloads[i] = std::vector<uint8_t>(KeychronV6PayloadLength, 0x00);
-            }
-
-            std::vector<uint8_t>& payload = payloads[i];
-            payload[0] = 0x00;
-            payload[1] = command;
-            payload[2] = channel;
-
-            payload[payload.size() - 1] = 0xFF;
-
-            for(size_t j = 3, k = unformattedPayload.size() - bytesLeft;
-                    j < KeychronV6PayloadLength - 1 && bytesLeft > 0;
-                    bytesLeft -= 4, k = unformattedPayload.size() - bytesLeft) {
-
-                uint8_t index = unformattedPayload[k];
-                uint8_t* rgb = &(unformattedPayload[k + 1]);
-
-                payload[j++] = index;
-                payload[j++] = rgb[0];
-                payload[j++] = rgb[1];
-                payload[j++] = rgb[2];
-            }
-        }
-
-        return payloads;
-    }
-
-
-
-    void loadDimmedKeys() {
-        dimmedKeysRGB = {};
-        for(auto it = dimmedKeysValues.begin(); it != dimmedKeysValues.end();) {
-            if(custom_leds.find(it->first) != custom_leds.end()) {
-                it++;
-                continue;
-            }
-
-            RGB rgb = framebuffer[it->first % framebuffer.size()];
-            dimmedKeysRGB[it->first] = {
-                (uint8_t)std::max(rgb.red / it->second, 0),
-                (uint8_t)std::max(rgb.green / it->second, 0),
-                (uint8_t)std::max(rgb.blue / it->second, 0)
-            };
-
-            it->second = std::max(it->second - 2, 0);
-            if(it->second <= 0) {
-                it = dimmedKeysValues.erase(it);
-                continue;
-            }
-
-            it++;
-        }
-    }
-
-    void draw_frame() {
-        if(!device) return;
-        if(!deviceMutex.try_lock()) return;
-
-        std::vector<uint8_t> unformattedPayload = getUnformattedPayload(framebuffer);
-        for(std::vector<uint8_t> payload : getPayloads(unformattedPayload, id_custom_set_value, id_custom_array_col_channel)) {
-            if(hid_write(device, payload.data(), payload.size() * sizeof(uint8_t)) == -1) {
-                deviceMutex.unlock();
-                return;
-            }
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        }
-
-        loadDimmedKeys();
-        unformattedPayload = getUnformattedPayload(custom_leds);
-
-        for(uint8_t data : getUnformattedPayload(dimmedKeysRGB)) {
-            unformattedPayload.push_back(data);
-        }
-
-        for(std::vector<uint8_t> payload : getPayloads(unformattedPayload, id_custom_set_value, id_custom_array_led_channel)) {
-            if(hid_write(device, payload.data(), payload.size() * sizeof(uint8_t)) == -1) {
-                deviceMutex.unlock();
-                return;
-            }
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        }
-
-        hid_write(device, DRAW_PACKET, (KeychronV6PayloadLength + 1) * sizeof(uint8_t));
-
-        framebuffer = emptyFramebuffer;
-
-        deviceMutex.unlock();
-    }
-};
-
-#endif
+#ifndef __KEYCHRON_V6_HPP__
+#define __KEYCHRON_V6_HPP__
+
+#include "../keyboard.hpp"
+#include "../description.hpp"
+#include "../../util/bytes.hpp"
+#include "../../util/frame.hpp"
+#include "../../util/suspend.hpp"
+#include "../../util/key_decay.hpp"
+#include "../../util/compositor.hpp"
+
+#include "KeychronV6Protocol.hpp"
+#include "KeychronV6Encoders.hpp"
+
+#include <hidapi/hidapi.h>
+#include <cmath>
+
+#include <algorithm>
+
+#include <map>
+#include <array>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+// led index of every key by [row][col], the same map as the firmware's cols table. 0xFF has no led
+const std::vector<std::vector<uint8_t>> KeychronV6LEDS = {
+    { 0,    1,    2,    3,    4,    5,    6,    7,    8,    9,    10,   11,   12,   0xFF, 13,   14,   15,   16,   17,   18,   19,   0xFF },
+    { 20,   21,   22,   23,   24,   25,   26,   27,   28,   29,   30,   31,   32,   0xFF, 33,   34,   35,   36,   37,   38,   39,   40   },
+    { 41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51,   52,   53,   54,   55,   56,   57,   58,   59,   60,   0xFF, 0xFF },
+    { 61,   62,   63,   64,   65,   66,   67,   68,   69,   70,   71,   72,   0xFF, 73,   0xFF, 0xFF, 0xFF, 74,   75,   76,   77,   0xFF },
+    { 78,   0xFF, 79,   80,   81,   82,   83,   84,   85,   86,   87,   88,   0xFF, 89,   0xFF, 90,   0xFF, 91,   92,   93,   0xFF, 0xFF },
+    { 94,   95,   96,   0xFF, 0xFF, 0xFF, 97,   0xFF, 0xFF, 0xFF, 98,   99,   100,  101,  102,  103,  104,  105,  106,  107,  0xFF, 0xFF },
+};
+
+// ansi layout in led order
+const std::vector<KeyRect> KeychronV6Keys = {
+    // esc, f1-f12, print screen row, 4 above the numpad
+    { 0, 0, 1, 1 },
+    { 2, 0, 1, 1 },     { 3, 0, 1, 1 },     { 4, 0, 1, 1 },     { 5, 0, 1, 1 },
+    { 6.5, 0, 1, 1 },   { 7.5, 0, 1, 1 },   { 8.5, 0, 1, 1 },   { 9.5, 0, 1, 1 },
+    { 11, 0, 1, 1 },    { 12, 0, 1, 1 },    { 13, 0, 1, 1 },    { 14, 0, 1, 1 },
+    { 15.25, 0, 1, 1 }, { 16.25, 0, 1, 1 }, { 17.25, 0, 1, 1 },
+    { 18.5, 0, 1, 1 },  { 19.5, 0, 1, 1 },  { 20.5, 0, 1, 1 },  { 21.5, 0, 1, 1 },
+
+    // ` to backspace, ins home pgup, numlock / * -
+    { 0, 1.25, 1, 1 },  { 1, 1.25, 1, 1 },  { 2, 1.25, 1, 1 },  { 3, 1.25, 1, 1 },  { 4, 1.25, 1, 1 },
+    { 5, 1.25, 1, 1 },  { 6, 1.25, 1, 1 },  { 7, 1.25, 1, 1 },  { 8, 1.25, 1, 1 },  { 9, 1.25, 1, 1 },
+    { 10, 1.25, 1, 1 }, { 11, 1.25, 1, 1 }, { 12, 1.25, 1, 1 }, { 13, 1.25, 2, 1 },
+    { 15.25, 1.25, 1, 1 }, { 16.25, 1.25, 1, 1 }, { 17.25, 1.25, 1, 1 },
+    { 18.5, 1.25, 1, 1 },  { 19.5, 1.25, 1, 1 },  { 20.5, 1.25, 1, 1 },  { 21.5, 1.25, 1, 1 },
+
+    // tab to backslash, del end pgdn, 7 8 9
+    { 0, 2.25, 1.5, 1 },
+    { 1.5, 2.25, 1, 1 },  { 2.5, 2.25, 1, 1 },  { 3.5, 2.25, 1, 1 },  { 4.5, 2.25, 1, 1 },  { 5.5, 2.25, 1, 1 },  { 6.5, 2.25, 1, 1 },
+    { 7.5, 2.25, 1, 1 },  { 8.5, 2.25, 1, 1 },  { 9.5, 2.25, 1, 1 },  { 10.5, 2.25, 1, 1 }, { 11.5, 2.25, 1, 1 }, { 12.5, 2.25, 1, 1 },
+    { 13.5, 2.25, 1.5, 1 },
+    { 15.25, 2.25, 1, 1 }, { 16.25, 2.25, 1, 1 }, { 17.25, 2.25, 1, 1 },
+    { 18.5, 2.25, 1, 1 },  { 19.5, 2.25, 1, 1 },  { 20.5, 2.25, 1, 1 },
+
+    // caps to enter, 4 5 6, numpad plus spanning two rows
+    { 0, 3.25, 1.75, 1 },
+    { 1.75, 3.25, 1, 1 }, { 2.75, 3.25, 1, 1 }, { 3.75, 3.25, 1, 1 }, { 4.75, 3.25, 1, 1 },  { 5.75, 3.25, 1, 1 },  { 6.75, 3.25, 1, 1 },
+    { 7.75, 3.25, 1, 1 }, { 8.75, 3.25, 1, 1 }, { 9.75, 3.25, 1, 1 }, { 10.75, 3.25, 1, 1 }, { 11.75, 3.25, 1, 1 },
+    { 12.75, 3.25, 2.25, 1 },
+    { 18.5, 3.25, 1, 1 },  { 19.5, 3.25, 1, 1 },  { 20.5, 3.25, 1, 1 },
+    { 21.5, 2.25, 1, 2 },
+
+    // left shift to right shift, up, 1 2 3
+    { 0, 4.25, 2.25, 1 },
+    { 2.25, 4.25, 1, 1 }, { 3.25, 4.25, 1, 1 }, { 4.25, 4.25, 1, 1 }, { 5.25, 4.25, 1, 1 },  { 6.25, 4.25, 1, 1 },
+    { 7.25, 4.25, 1, 1 }, { 8.25, 4.25, 1, 1 }, { 9.25, 4.25, 1, 1 }, { 10.25, 4.25, 1, 1 }, { 11.25, 4.25, 1, 1 },
+    { 12.25, 4.25, 2.75, 1 },
+    { 16.25, 4.25, 1, 1 },
+    { 18.5, 4.25, 1, 1 },  { 19.5, 4.25, 1, 1 },  { 20.5, 4.25, 1, 1 },
+
+    // bottom row, arrows, 0 . and numpad enter spanning two rows
+    { 0, 5.25, 1.25, 1 },     { 1.25, 5.25, 1.25, 1 },  { 2.5, 5.25, 1.25, 1 },
+    { 3.75, 5.25, 6.25, 1 },
+    { 10, 5.25, 1.25, 1 },    { 11.25, 5.25, 1.25, 1 }, { 12.5, 5.25, 1.25, 1 }, { 13.75, 5.25, 1.25, 1 },
+    { 15.25, 5.25, 1, 1 },    { 16.25, 5.25, 1, 1 },    { 17.25, 5.25, 1, 1 },
+    { 18.5, 5.25, 2, 1 },     { 20.5, 5.25, 1, 1 },
+    { 21.5, 4.25, 1, 2 },
+};
+
+// evdev key code of every led, 0xFFFF has no key
+const uint16_t KeychronV6KeyCodes[KeychronV6TotalLEDs] = {
+    { KEY_ESC },  { KEY_F1 }, { KEY_F2 }, { KEY_F3 }, { KEY_F4 },  { KEY_F5 }, { KEY_F6 }, { KEY_F7 }, { KEY_F8 },  { KEY_F9 }, { KEY_F10 }, { KEY_F11 }, { KEY_F12 },    { KEY_PRINT }, { KEY_SCROLLLOCK }, { 0xFFFF },    { 0xFFFF }, { 0xFFFF }, { 0xFFFF }, { 0xFFFF },
+    { KEY_GRAVE }, { KEY_1 }, { KEY_2 }, { KEY_3 }, { KEY_4 }, { KEY_5 }, { KEY_6 }, { KEY_7 }, { KEY_8 }, { KEY_9 }, { KEY_0 }, { KEY_MINUS }, { KEY_EQUAL }, { KEY_BACKSPACE },   { KEY_INSERT }, { KEY_HOME }, { KEY_PAGEUP },   { KEY_NUMLOCK }, { KEY_KPSLASH }, { KEY_KPASTERISK }, { KEY_KPMINUS },
+    { KEY_TAB }, { KEY_Q }, { KEY_W }, { KEY_E }, { KEY_R }, { KEY_T }, { KEY_Y }, { KEY_U }, { KEY_I }, { KEY_O }, { KEY_P }, { KEY_LEFTBRACE }, { KEY_RIGHTBRACE }, { KEY_BACKSLASH }, { KEY_DELETE }, { KEY_END }, { KEY_PAGEDOWN }, { KEY_KP7 }, { KEY_KP8 }, { KEY_KP9 },
+    { KEY_CAPSLOCK }, { KEY_A }, { KEY_S }, { KEY_D }, { KEY_F }, { KEY_G }, { KEY_H }, { KEY_J }, { KEY_K }, { KEY_L }, { KEY_SEMICOLON }, { KEY_APOSTROPHE }, { KEY_ENTER }, { KEY_KP4 }, { KEY_KP5 }, { KEY_KP6 }, { KEY_KPPLUS },
+    { KEY_LEFTSHIFT }, { KEY_Z }, { KEY_X }, { KEY_C }, { KEY_V }, { KEY_B }, { KEY_N }, { KEY_M }, { KEY_COMMA }, { KEY_DOT }, { KEY_SLASH }, { KEY_RIGHTSHIFT }, { KEY_UP }, { KEY_KP1 }, { KEY_KP2 }, { KEY_KP3 },
+    { KEY_LEFTCTRL }, { KEY_LEFTMETA }, { KEY_LEFTALT }, { KEY_SPACE }, { KEY_RIGHTALT }, { KEY_RIGHTMETA }, { 0xFFFF }, { KEY_RIGHTCTRL }, { KEY_LEFT }, { KEY_DOWN }, { KEY_RIGHT }, { KEY_KP0 }, { KEY_KPDOT }, { KEY_KPENTER }
+};
+
+const uint8_t KeychronV6Cols = KeychronV6Traits::COLS;
+const uint8_t KeychronV6Rows = KeychronV6Traits::ROWS;
+
+// bottom to top
+enum KeychronV6Layer {
+    KEYCHRON_LAYER_COLS = 0,
+    KEYCHRON_LAYER_KEYS,
+    // frames from other processes, over the effects
+    KEYCHRON_LAYER_EXTERNAL,
+    // added over the keys, ripples and other highlights
+    KEYCHRON_LAYER_OVERLAY,
+    KEYCHRON_LAYER_DECAY,
+    KEYCHRON_LAYER_CUSTOM,
+    KEYCHRON_LAYER_COUNT
+};
+
+// the encoded columns of every phase of one cycle of a periodic effect
+struct KeychronV6FrameCache {
+    size_t length = 0;
+    size_t maxBytes = 0;
+
+    // fills the KeychronV6Cols column colours of a phase
+    std::function<void(size_t, RGB*)> render;
+
+    // the protocol version it was built for, 0 if it has not been
+    uint8_t builtFor = 0;
+    bool fits = false;
+
+    // [phase * KeychronV6Cols + col]
+    std::vector<RGB> cols;
+    // the reports of phase are reports[offsets[phase]] up to reports[offsets[phase + 1]]
+    std::vector<KeychronV6Report> reports;
+    std::vector<size_t> offsets;
+
+    size_t bytes() const {
+        return cols.size() * sizeof(RGB) + reports.size() * sizeof(KeychronV6Report) + offsets.size() * sizeof(size_t);
+    }
+};
+
+// led of every evdev key code, 0xFF has none. a base of KeychronV6 before Keyboard rather than a member,
+// so it is filled in before Device's constructor starts the input threads that read it, and never reallocates after
+struct KeychronV6KeyMap {
+    std::array<uint8_t, KEY_CNT> keyLEDs;
+
+    KeychronV6KeyMap(const std::vector<uint8_t>& keyLEDs) {
+        this->keyLEDs.fill(0xFF);
+        std::copy_n(keyLEDs.begin(), std::min(keyLEDs.size(), this->keyLEDs.size()), this->keyLEDs.begin());
+    }
+};
+
+class KeychronV6 : private KeychronV6KeyMap, public Keyboard {
+public:
+    typedef KeychronV6Traits::LEDFrame LEDFrame;
+    typedef KeychronV6Traits::ColFrame ColFrame;
+    typedef BasicLayer<KeychronV6Traits::LEDS> Layer;
+
+    std::map<uint8_t, time_t> keypressStartTimes;
+
+private:
+    const uint8_t DRAW_PACKET[KeychronV6PayloadLength + 1] = { 0x00, id_custom_set_value, id_custom_draw_channel };
+    ColFrame framebuffer;
+    BasicCompositor<KeychronV6Traits::LEDS> compositor;
+
+    // the composited frame, split into columns and the leds that differ from their column for sending
+    LEDFrame ledFramebuffer;
+    ColFrame colFramebuffer;
+    LEDFrame residualFramebuffer;
+
+    uint8_t ledCols[KeychronV6TotalLEDs];
+    uint8_t ledRows[KeychronV6TotalLEDs];
+    // the led standing in for each column when splitting, 0xFF for empty columns
+    uint8_t colLEDs[KeychronV6Cols];
+
+    // pressed keys dim and fade back in
+    KeyDecay keyDecay;
+
+    // the custom leds as of the last frame
+    LEDOverlaySnapshot customLEDs;
+
+    // 0 until the firmware has been probed
+    uint8_t protocolVersion;
+    uint16_t viaProtocolVersion;
+
+    std::vector<std::unique_ptr<KeychronV6Encoder>> encoders;
+    std::vector<KeychronV6Report> reports;
+
+    KeychronV6FrameCache frameCache;
+    // phase of the cache the next frame draws, SIZE_MAX draws the columns that were set
+    size_t cachedPhase;
+
+    std::mutex keyPressHandlerMutex;
+    std::function<void(uint8_t)> keyPressHandler;
+
+    // whether the keyboard is known to be in the custom frame effect
+    std::atomic<bool> effectActive;
+
+    // every frame is scaled by this once composited, see set_brightness
+    std::atomic<uint8_t> brightness;
+    SuspendDetector suspendDetector;
+
+    // every report we send gets a reply.
+    // v4 firmware says in the draw reply if the effect is still the active mode
+    void handle_reply(const uint8_t* response) {
+        if(protocolVersion < KeychronV6ProtocolV4) return;
+        if(response[0] != id_custom_set_value || response[1] != id_custom_draw_channel) return;
+
+        if(effectActive && response[2] == 0) {
+            printf("Keychron V6 left the custom effect, setting it again\n");
+        }
+
+        effectActive = response[2] != 0;
+    }
+
+    // deviceMutex must be held, reads the replies to the last frame
+    void read_replies() {
+        uint8_t response[KeychronV6PayloadLength];
+
+        while(hid_read_timeout(device, response, KeychronV6PayloadLength, 0) > 0) {
+            handle_reply(response);
+        }
+    }
+
+    // deviceMutex must be held, reads pending replies then waits for the reply to command
+    bool via_request(uint8_t command, uint8_t channel, uint8_t* response) {
+        uint8_t payload[KeychronV6PayloadLength + 1];
+        std::memset(payload, 0x00, KeychronV6PayloadLength + 1);
+
+        payload[1] = command;
+        payload[2] = channel;
+
+        read_replies();
+
+        if(write_report(payload, (KeychronV6PayloadLength + 1) * sizeof(uint8_t)) == -1) {
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while(std::chrono::steady_clock::now() < deadline) {
+            int timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if(hid_read_timeout(device, response, KeychronV6PayloadLength, std::max(timeout, 1)) <= 0) {
+                return false;
+            }
+
+            if(response[0] != command && response[0] != id_unhandled) {
+                handle_reply(response);
+                continue;
+            }
+
+            if(command != id_get_protocol_version && response[1] != channel) continue;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // deviceMutex must be held
+    void probe_protocol() {
+        uint8_t response[KeychronV6PayloadLength];
+
+        protocolVersion = KeychronV6ProtocolV1;
+        viaProtocolVersion = 0;
+
+        reset_encoders();
+
+        if(!via_request(id_get_protocol_version, 0x00, response)) {
+            printf("Keychron V6 did not answer the protocol version probe, using protocol v%u\n", protocolVersion);
+            return;
+        }
+
+        viaProtocolVersion = (response[1] << 8) | response[2];
+
+        // older firmware leaves the channel unhandled
+        if(via_request(id_custom_get_value, id_custom_protocol_channel, response) && response[0] == id_custom_get_value) {
+            protocolVersion = std::max(response[2], KeychronV6ProtocolV1);
+        }
+
+        printf("Keychron V6 via protocol %.4X, custom protocol v%u\n", viaProtocolVersion, protocolVersion);
+
+        if(protocolVersion >= KeychronV6ProtocolV4 && via_request(id_custom_get_value, id_custom_set_effect_channel, response)) {
+            effectActive = response[0] == id_custom_get_value && response[2] != 0;
+        }
+    }
+
+    // deviceMutex must be held
+    bool write_effect() {
+        uint8_t payload[KeychronV6PayloadLength + 1];
+        std::memset(payload, 0x00, KeychronV6PayloadLength + 1);
+
+        payload[1] = KeychronV6PacketCommands::id_custom_set_value;
+        payload[2] = KeychronV6PacketChannels::id_custom_set_effect_channel;
+
+        return write_report(payload, (KeychronV6PayloadLength + 1) * sizeof(uint8_t)) != -1;
+    }
+
+    // the protocol version request is answered by any via firmware
+    bool send_probe() {
+        uint8_t response[KeychronV6PayloadLength];
+
+        return via_request(id_get_protocol_version, 0x00, response);
+    }
+
+
+    void reset_encoders() {
+        for(std::unique_ptr<KeychronV6Encoder>& encoder : encoders) {
+            encoder->reset();
+        }
+    }
+
+    // picks the cheapest encoder the firmware can decode, frame is a LEDFrame or a ColFrame
+    template<size_t N>
+    KeychronV6Encoder* select_encoder(const BasicFrame<N>& frame, bool statelessOnly = false) {
+        KeychronV6Encoder* best = nullptr;
+        size_t bestCost = 0;
+
+        for(std::unique_ptr<KeychronV6Encoder>& encoder : encoders) {
+            if(encoder->protocolVersion() > protocolVersion || !encoder->supports(KeychronV6Encoder::target<N>())) continue;
+            if(statelessOnly && !encoder->stateless()) continue;
+
+            size_t cost = encoder->cost(frame);
+            if(!best || cost < bestCost) {
+                best = encoder.get();
+                bestCost = cost;
+            }
+        }
+
+        return best;
+    }
+
+
+    // deviceMutex must be held, encodes every phase with encoders that do not depend on what was sent before
+    void build_frame_cache() {
+        frameCache.builtFor = protocolVersion;
+        frameCache.fits = false;
+
+        frameCache.cols = std::vector<RGB>(frameCache.length * KeychronV6Cols);
+        frameCache.reports.clear();
+        frameCache.offsets = { 0 };
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ColFrame cols;
+        for(size_t phase = 0; phase < frameCache.length; phase++) {
+            RGB* phaseCols = &frameCache.cols[phase * KeychronV6Cols];
+            frameCache.render(phase, phaseCols);
+
+            for(uint8_t col = 0; col < KeychronV6Cols; col++) {
+                if(colLEDs[col] != 0xFF) cols.set(col, phaseCols[col]);
+            }
+
+            select_encoder(cols, true)->encode(cols, &frameCache.reports);
+            frameCache.offsets.push_back(frameCache.reports.size());
+
+            if(frameCache.bytes() > frameCache.maxBytes) {
+                printf("Keychron V6 frame cache of %zu phases is over %zu bytes, drawing it live\n", frameCache.length, frameCache.maxBytes);
+
+                frameCache.cols.clear();
+                frameCache.reports.clear();
+                frameCache.offsets.clear();
+
+                return;
+            }
+        }
+
+        frameCache.fits = true;
+
+        long long took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        printf("Keychron V6 frame cache: %zu phases, %zu reports, %zu bytes in %lldus\n", frameCache.length, frameCache.reports.size(), frameCache.bytes(), took);
+    }
+
+    // whether the frame is only the columns, which is what the cache holds
+    bool only_columns() {
+        const Layer& cols = compositor.get_layer(KEYCHRON_LAYER_COLS);
+        if(cols.mode != BLEND_REPLACE || cols.opacity != 0xFF) return false;
+
+        for(size_t layer = KEYCHRON_LAYER_COLS + 1; layer < KEYCHRON_LAYER_COUNT; layer++) {
+            if(compositor.get_layer(layer).visible()) return false;
+        }
+
+        return true;
+    }
+
+
+    void onDeviceEvent(struct libevdev* device, struct input_event* event) {
+        // printf(
+        //     "Event: %s %s %d, %u\n",
+        //     libevdev_event_type_get_name(event->type),
+        //     libevdev_event_code_get_name(event->type, event->code),
+        //     event->value,
+        //     event->code
+        // );
+
+        if(event->type != EV_KEY) return;
+
+        switch(event->type) {
+        case EV_KEY: {
+            switch(event->value) {
+            case 1: {
+                keypressStartTimes[event->code] = time(NULL);
+            }
+            case 2: {
+                uint8_t idx = event->code < keyLEDs.size() ? keyLEDs[event->code] : 0xFF;
+                if(idx == 0xFF) break;
+
+                keyDecay.press(idx);
+
+                if(event->value == 1) {
+                    std::lock_guard<std::mutex> lock(keyPressHandlerMutex);
+                    if(keyPressHandler) keyPressHandler(idx);
+                }
+
+                break;
+            }
+            case 0:
+                auto it = keypressStartTimes.find(event->code);
+                if(it == keypressStartTimes.end()) break;
+
+                keypressStartTimes.erase(it);
+                break;
+            }
+
+            break;
+        }
+        default: break;
+        }
+    }
+
+    // channel names of a description and the encoder each adds
+    void add_channel_encoder(const std::string& channel) {
+        if(channel == "array") add_encoder(std::make_unique<KeychronV6ArrayEncoder>());
+        else if(channel == "packed") add_encoder(std::make_unique<KeychronV6PackedEncoder>());
+        else if(channel == "rle") add_encoder(std::make_unique<KeychronV6RLEEncoder>());
+        else if(channel == "palette") add_encoder(std::make_unique<KeychronV6PaletteEncoder>());
+    }
+
+public:
+    // the layout this driver was written for
+    static DeviceDescription builtin_description() {
+        DeviceDescription description;
+        description.name = "Keychron V6";
+        description.driver = "keychron-v6";
+
+        description.vendorId = 0x3434;
+        description.productId = 0x0361;
+        description.usagePage = 0xFF60;
+        description.usage = 0x0061;
+
+        description.reportLength = KeychronV6Traits::REPORT_LENGTH;
+        description.channels = { "array", "packed", "rle", "palette" };
+
+        description.ledCount = KeychronV6TotalLEDs;
+        description.rows = KeychronV6Rows;
+        description.cols = KeychronV6Cols;
+
+        description.leds = KeychronV6LEDS;
+        description.keys = KeychronV6Keys;
+        description.setKeyCodes(KeychronV6KeyCodes, KeychronV6TotalLEDs);
+
+        return description;
+    }
+
+    // the encoders and framebuffers are sized by KeychronV6Traits, a description has to match them.
+    // so only variants of the V6 itself can be described, its ids, keymap, key positions and channels
+    static bool accepts(const DeviceDescription& description, std::string& error) {
+        if(description.driver != "keychron-v6") error = "driver is " + description.driver + ", not keychron-v6";
+        else if(description.reportLength != KeychronV6Traits::REPORT_LENGTH) error = "report_length has to be " + std::to_string(KeychronV6Traits::REPORT_LENGTH);
+        else if(description.ledCount != KeychronV6Traits::LEDS) error = "there have to be " + std::to_string(KeychronV6Traits::LEDS) + " leds";
+        else if(description.rows != KeychronV6Traits::ROWS || description.cols != KeychronV6Traits::COLS) {
+            error = "leds has to be " + std::to_string(KeychronV6Traits::ROWS) + " rows of " + std::to_string(KeychronV6Traits::COLS);
+        }
+        // every firmware decodes array, for both targets, so there is always an encoder to fall back on
+        else if(!description.hasChannel("array")) error = "channels has to have array";
+        else {
+            for(const std::string& channel : description.channels) {
+                if(channel == "array" || channel == "packed" || channel == "rle" || channel == "palette") continue;
+
+                error = "unknown channel " + channel;
+                return false;
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    KeychronV6() : KeychronV6(builtin_description()) {}
+
+    // description has to pass accepts()
+    KeychronV6(const DeviceDescription& description) : KeychronV6KeyMap(description.keyLEDs), Keyboard(description.vendorId, description.productId, description.usagePage, description.usage, description.leds, [this]() -> void {
+        // the firmware may have been flashed or reset while disconnected
+        this->protocolVersion = 0;
+        this->effectActive = false;
+    }) {
+        framebuffer.fill({ 0x00, 0x00, 0x00 });
+
+        compositor.add_layer(BLEND_REPLACE);
+        compositor.add_layer(BLEND_REPLACE);
+        compositor.add_layer(BLEND_REPLACE);
+        compositor.add_layer(BLEND_ADD);
+        compositor.add_layer(BLEND_MULTIPLY);
+        compositor.add_layer(BLEND_REPLACE);
+
+        customLEDs = {};
+
+        geometry = DeviceGeometry(description.keys);
+
+        std::fill(colLEDs, colLEDs + KeychronV6Cols, 0xFF);
+        for(uint8_t row = 0; row < KeychronV6Rows; row++) {
+            for(uint8_t col = 0; col < KeychronV6Cols; col++) {
+                uint8_t led = leds[row][col];
+                if(led >= KeychronV6TotalLEDs) continue;
+
+                ledCols[led] = col;
+                ledRows[led] = row;
+
+                if(colLEDs[col] == 0xFF) colLEDs[col] = led;
+            }
+        }
+
+        protocolVersion = 0;
+        viaProtocolVersion = 0;
+
+        effectActive = false;
+        cachedPhase = SIZE_MAX;
+        brightness = 0xFF;
+
+        // first match wins on equal cost
+        for(const std::string& channel : description.channels) {
+            add_channel_encoder(channel);
+        }
+
+        startProbeThread(std::chrono::seconds(1));
+    }
+
+    virtual ~KeychronV6() {
+        stopProbeThread();
+    }
+
+
+    uint8_t getCols() { return KeychronV6Cols; }
+    uint8_t getRows() { return KeychronV6Rows; }
+
+    void set_col(uint8_t col, RGB rgb) {
+        if(col >= KeychronV6Cols) return;
+
+        framebuffer.set(col, rgb);
+    }
+
+    void set_led(uint8_t col, RGB rgb) {
+        if(col >= KeychronV6Cols) return;
+
+        framebuffer.set(col, rgb);
+    }
+
+    // sets a single led for the next frame, leds set here are drawn over the columns
+    void set_frame_led(uint8_t led, RGB rgb) {
+        compositor.get_layer(KEYCHRON_LAYER_KEYS).frame.set(led, rgb);
+    }
+
+    // draw_frame rebuilds the cols, decay and custom layers and clears the keys and overlay layers after sending,
+    // the external layer is kept until whoever fills it clears it
+    // opacity and blend mode of any layer stick, only the thread calling draw_frame should touch them
+    Layer& get_layer(KeychronV6Layer layer) {
+        return compositor.get_layer(layer);
+    }
+
+    // called from the input threads with the led of every newly pressed key
+    void on_key_press(std::function<void(uint8_t)> handler) {
+        std::lock_guard<std::mutex> lock(keyPressHandlerMutex);
+        keyPressHandler = handler;
+    }
+
+    uint8_t get_led_col(uint8_t led) { return led < KeychronV6TotalLEDs ? ledCols[led] : 0xFF; }
+    uint8_t get_led_row(uint8_t led) { return led < KeychronV6TotalLEDs ? ledRows[led] : 0xFF; }
+
+    void add_encoder(std::unique_ptr<KeychronV6Encoder> encoder) {
+        deviceMutex.lock();
+        encoders.push_back(std::move(encoder));
+        deviceMutex.unlock();
+    }
+
+    // 0 if the firmware has not been probed yet
+    uint8_t get_protocol_version() { return protocolVersion; }
+
+    // draw_frame sets the effect whenever it is not known to be active,
+    // this only needs calling to force it
+    void set_effect() {
+        if(!device) return;
+
+        deviceMutex.lock();
+        effectActive = write_effect();
+        deviceMutex.unlock();
+    }
+
+    // for anything outside that may have reset the keyboard mode
+    void invalidate_effect() {
+        effectActive = false;
+    }
+
+    bool is_effect_active() { return effectActive; }
+
+    // the composited frame and the reports draw_frame last sent, only the thread calling draw_frame may read them
+    const LEDFrame& get_shown_frame() { return ledFramebuffer; }
+    const std::vector<KeychronV6Report>& get_sent_reports() { return reports; }
+
+    // declares the columns periodic, render(phase, cols) fills the colours of each of the length phases of one cycle.
+    // the cycle is encoded once the firmware has been probed and then replayed by draw_cached_frame.
+    // a cycle needing more than maxBytes is drawn live instead
+    void set_frame_cache(size_t length, std::function<void(size_t, RGB*)> render, size_t maxBytes) {
+        deviceMutex.lock();
+
+        frameCache = KeychronV6FrameCache();
+        frameCache.length = length;
+        frameCache.maxBytes = maxBytes;
+        frameCache.render = render;
+
+        deviceMutex.unlock();
+    }
+
+    void clear_frame_cache() {
+        set_frame_cache(0, nullptr, 0);
+    }
+
+    // draws a phase of the cached cycle in place of set_col, anything drawn over the columns still works.
+    // false without a cache or if no frame was sent
+    bool draw_cached_frame(size_t phase) {
+        if(frameCache.length == 0) return false;
+
+        cachedPhase = phase % frameCache.length;
+        bool sent = draw_frame();
+        cachedPhase = SIZE_MAX;
+
+        return sent;
+    }
+
+
+    // scales everything drawn from the next frame, 0 is dark. cached frames are only replayed at full brightness
+    void set_brightness(uint8_t level) {
+        brightness = level;
+    }
+
+    // swaps the decay curve, takes effect from the next frame
+    void set_key_decay(KeyDecayConfig config) {
+        deviceMutex.lock();
+        keyDecay.setCurve(config);
+        deviceMutex.unlock();
+    }
+
+    // each led's key decay intensity as of the last frame, 255 right after a press.
+    // only the thread calling draw_frame may read it
+    void get_key_heat(uint8_t* out) {
+        for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+            out[led] = keyDecay.getIntensity(led);
+        }
+    }
+
+    // deviceMutex must be held, fills the layers draw_frame owns
+    void loadLayers() {
+        LEDFrame& cols = compositor.get_layer(KEYCHRON_LAYER_COLS).frame;
+        for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+            cols.set(led, framebuffer.colors[ledCols[led]]);
+        }
+
+        // multiplying by the dimmed white of each pressed key
+        keyDecay.step(KeychronV6TotalLEDs);
+
+        LEDFrame& decay = compositor.get_layer(KEYCHRON_LAYER_DECAY).frame;
+        decay.fill({ 0xFF, 0xFF, 0xFF });
+        keyDecay.apply(decay.colors, KeychronV6TotalLEDs);
+
+        for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+            if(!keyDecay.getIntensity(led)) decay.unset(led);
+        }
+
+        // the custom layer is kept between frames and only rebuilt when the overlay changed
+        if(custom_leds.getGeneration() != customLEDs.generation) {
+            custom_leds.snapshot(customLEDs);
+
+            LEDFrame& custom = compositor.get_layer(KEYCHRON_LAYER_CUSTOM).frame;
+            custom.clear();
+
+            for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+                if(customLEDs.has(led)) custom.set(led, customLEDs.get(led));
+            }
+        }
+    }
+
+    // splits ledFramebuffer into columns plus the leds that differ from their column,
+    // returns false if sending every led is cheaper
+    bool split_columns() {
+        colFramebuffer.clear();
+        residualFramebuffer.clear();
+
+        for(uint8_t col = 0; col < KeychronV6Cols; col++) {
+            if(colLEDs[col] != 0xFF) colFramebuffer.set(col, ledFramebuffer.colors[colLEDs[col]]);
+        }
+
+        for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+            const RGB& rgb = ledFramebuffer.colors[led];
+            const RGB& colRGB = colFramebuffer.colors[ledCols[led]];
+
+            if(rgb.red != colRGB.red || rgb.green != colRGB.green || rgb.blue != colRGB.blue) {
+                residualFramebuffer.set(led, rgb);
+            }
+        }
+
+        size_t splitCost = select_encoder(colFramebuffer)->cost(colFramebuffer);
+        if(residualFramebuffer.count() > 0) {
+            splitCost += select_encoder(residualFramebuffer)->cost(residualFramebuffer);
+        }
+
+        return splitCost <= select_encoder(ledFramebuffer)->cost(ledFramebuffer);
+    }
+
+    // false if the keyboard is gone, busy with another thread or a report failed.
+    // only then do get_shown_frame and get_sent_reports hold what it shows
+    bool draw_frame() {
+        if(!device) return false;
+        if(!deviceMutex.try_lock()) return false;
+
+        // usb devices can lose power while suspended
+        if(suspendDetector.resumed()) {
+            printf("Resumed from suspend, probing Keychron V6 again\n");
+
+            protocolVersion = 0;
+            effectActive = false;
+        }
+
+        if(protocolVersion == 0) {
+            probe_protocol();
+        }
+
+        read_replies();
+
+        if(!effectActive) {
+            effectActive = write_effect();
+        }
+
+        bool replay = false;
+        if(cachedPhase < frameCache.length) {
+            if(frameCache.builtFor != protocolVersion) {
+                build_frame_cache();
+            }
+
+            RGB cols[KeychronV6Cols];
+            if(frameCache.fits) std::copy_n(&frameCache.cols[cachedPhase * KeychronV6Cols], KeychronV6Cols, cols);
+            else frameCache.render(cachedPhase, cols);
+
+            for(uint8_t col = 0; col < KeychronV6Cols; col++) {
+                framebuffer.set(col, cols[col]);
+            }
+
+            replay = frameCache.fits;
+        }
+
+        loadLayers();
+
+        // the split is lossless, leds go after the columns so they draw over them
+        reports.clear();
+
+        uint8_t level = brightness;
+
+        if(replay && level == 0xFF && only_columns()) {
+            // only kept up to date for get_shown_frame, the cached reports already hold it
+            ledFramebuffer = compositor.get_layer(KEYCHRON_LAYER_COLS).frame;
+
+            reports.assign(
+                frameCache.reports.begin() + frameCache.offsets[cachedPhase],
+                frameCache.reports.begin() + frameCache.offsets[cachedPhase + 1]
+            );
+        }
+        else {
+            compositor.composite(ledFramebuffer);
+
+            // scaled like a multiply layer of grey
+            if(level != 0xFF) {
+                for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+                    RGB& rgb = ledFramebuffer.colors[led];
+
+                    rgb.red = (rgb.red * level + 255) >> 8;
+                    rgb.green = (rgb.green * level + 255) >> 8;
+                    rgb.blue = (rgb.blue * level + 255) >> 8;
+                }
+            }
+
+            if(split_columns()) {
+                select_encoder(colFramebuffer)->encode(colFramebuffer, &reports);
+
+                if(residualFramebuffer.count() > 0) {
+                    select_encoder(residualFramebuffer)->encode(residualFramebuffer, &reports);
+                }
+            }
+            else {
+                select_encoder(ledFramebuffer)->encode(ledFramebuffer, &reports);
+            }
+        }
+
+        for(KeychronV6Report& report : reports) {
+            if(write_report(report.data(), report.size() * sizeof(uint8_t)) == -1) {
+                // a palette may have been half sent and the keyboard may have reset
+                reset_encoders();
+                effectActive = false;
+
+                deviceMutex.unlock();
+                return false;
+            }
+        }
+
+        bool sent = write_report(DRAW_PACKET, (KeychronV6PayloadLength + 1) * sizeof(uint8_t)) != -1;
+
+        framebuffer.fill({ 0x00, 0x00, 0x00 });
+        compositor.get_layer(KEYCHRON_LAYER_KEYS).frame.clear();
+        compositor.get_layer(KEYCHRON_LAYER_OVERLAY).frame.clear();
+
+        deviceMutex.unlock();
+
+        return sent;
+    }
+};
+
+#endif
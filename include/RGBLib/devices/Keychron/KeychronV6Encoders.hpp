@@ -0,0 +1,464 @@
+#ifndef __KEYCHRON_V6_ENCODERS_HPP__
+#define __KEYCHRON_V6_ENCODERS_HPP__
+
+#include "KeychronV6Protocol.hpp"
+#include "../../util/frame.hpp"
+
+#include <vector>
+#include <bitset>
+#include <cstring>
+#include <cstdlib>
+
+// fills reports of one channel back to back, 0xFF marks the end of the data
+// in a report that is not full. passing no output only counts reports
+template<typename Traits>
+class KeychronReportWriter {
+private:
+    typedef typename Traits::Report Report;
+
+    std::vector<Report>* out;
+    Report scratch;
+
+    uint8_t command;
+    uint8_t channel;
+
+    size_t reports;
+    size_t pos;
+
+    uint8_t* current() {
+        return out ? out->back().data() : scratch.data();
+    }
+
+public:
+    static constexpr size_t DATA_START = 3;
+    static constexpr size_t REPORT_END = Traits::REPORT_LENGTH;
+
+    KeychronReportWriter(std::vector<Report>* out, uint8_t command, uint8_t channel) :
+        out(out), command(command), channel(channel), reports(0), pos(REPORT_END) {}
+
+    size_t remaining() { return REPORT_END - pos; }
+
+    // starts a new report if the current one has less than bytes left
+    void reserve(size_t bytes) {
+        if(remaining() >= bytes) return;
+
+        finish();
+
+        if(out) out->emplace_back();
+        uint8_t* report = current();
+        std::memset(report, 0x00, REPORT_END);
+
+        report[0] = 0x00;
+        report[1] = command;
+        report[2] = channel;
+
+        pos = DATA_START;
+        reports++;
+    }
+
+    void put(uint8_t byte) {
+        current()[pos++] = byte;
+    }
+
+    void put(RGB rgb) {
+        uint8_t* report = current();
+
+        report[pos++] = rgb.red;
+        report[pos++] = rgb.green;
+        report[pos++] = rgb.blue;
+    }
+
+    // writes to a byte already reserved in the current report
+    void patch(size_t at, uint8_t byte) {
+        current()[at] = byte;
+    }
+
+    size_t position() { return pos; }
+
+    // terminates the current report
+    size_t finish() {
+        if(reports > 0 && pos < REPORT_END) {
+            current()[pos] = 0xFF;
+        }
+
+        pos = REPORT_END;
+        return reports;
+    }
+};
+
+
+// one virtual call per frame, the loops inside are templates over the frame's size
+template<typename Traits>
+class KeychronEncoder {
+public:
+    typedef typename Traits::Report Report;
+    typedef typename Traits::LEDFrame LEDFrame;
+    typedef typename Traits::ColFrame ColFrame;
+
+    static_assert(Traits::LEDS != Traits::COLS, "led and column frames are told apart by their size");
+
+    // which index space a frame of N entries is addressed in
+    template<size_t N>
+    static constexpr KeychronV6Target target() {
+        return N == Traits::COLS ? TARGET_COLS : TARGET_LEDS;
+    }
+
+    virtual ~KeychronEncoder() {}
+
+    virtual const char* name() = 0;
+    // lowest custom protocol version the firmware needs to decode this
+    virtual uint8_t protocolVersion() = 0;
+
+    // appends the reports for the masked entries of frame to out, returns how many were added.
+    // with out as nullptr nothing is written and only the report count is returned
+    virtual size_t encode(const LEDFrame& frame, std::vector<Report>* out) = 0;
+    virtual size_t encode(const ColFrame& frame, std::vector<Report>* out) = 0;
+
+    virtual bool supports(KeychronV6Target) { return true; }
+
+    // called when the firmware may have lost what was sent before
+    virtual void reset() {}
+
+    // whether the reports only depend on the frame, so they can be stored and sent again later
+    virtual bool stateless() { return true; }
+
+    template<size_t N>
+    size_t cost(const BasicFrame<N>& frame) {
+        return encode(frame, nullptr);
+    }
+};
+
+
+// v1: [index r g b]... 7 entries per report
+template<typename Traits>
+class KeychronArrayEncoder : public KeychronEncoder<Traits> {
+private:
+    typedef typename KeychronEncoder<Traits>::Report Report;
+    typedef typename KeychronEncoder<Traits>::LEDFrame LEDFrame;
+    typedef typename KeychronEncoder<Traits>::ColFrame ColFrame;
+
+    template<size_t N>
+    size_t encodeFrame(const BasicFrame<N>& frame, std::vector<Report>* out) {
+        // one byte is always left for the terminator
+        KeychronReportWriter<Traits> writer(out, id_custom_set_value, Traits::ARRAY_CHANNELS[this->template target<N>()]);
+
+        for(size_t i = 0; i < N; i++) {
+            if(!frame.mask.test(i)) continue;
+
+            writer.reserve(5);
+            writer.put((uint8_t)i);
+            writer.put(frame.colors[i]);
+        }
+
+        return writer.finish();
+    }
+
+public:
+    const char* name() { return "array"; }
+    uint8_t protocolVersion() { return KeychronV6ProtocolV1; }
+
+    size_t encode(const LEDFrame& frame, std::vector<Report>* out) { return encodeFrame(frame, out); }
+    size_t encode(const ColFrame& frame, std::vector<Report>* out) { return encodeFrame(frame, out); }
+};
+
+// v2: [start count (r g b) * count]... 9 entries per report for a contiguous run
+template<typename Traits>
+class KeychronPackedEncoder : public KeychronEncoder<Traits> {
+private:
+    typedef typename KeychronEncoder<Traits>::Report Report;
+    typedef typename KeychronEncoder<Traits>::LEDFrame LEDFrame;
+    typedef typename KeychronEncoder<Traits>::ColFrame ColFrame;
+
+    template<size_t N>
+    size_t encodeFrame(const BasicFrame<N>& frame, std::vector<Report>* out) {
+        KeychronReportWriter<Traits> writer(out, id_custom_set_value, Traits::PACKED_CHANNELS[this->template target<N>()]);
+
+        size_t i = 0;
+        while(i < N) {
+            if(!frame.mask.test(i)) {
+                i++;
+                continue;
+            }
+
+            writer.reserve(2 + sizeof(RGB));
+            writer.put((uint8_t)i);
+
+            size_t countAt = writer.position();
+            writer.put((uint8_t)0);
+
+            uint8_t count = 0;
+            while(i < N && frame.mask.test(i) && writer.remaining() >= sizeof(RGB)) {
+                writer.put(frame.colors[i++]);
+                count++;
+            }
+
+            writer.patch(countAt, count);
+        }
+
+        return writer.finish();
+    }
+
+public:
+    const char* name() { return "packed"; }
+    uint8_t protocolVersion() { return KeychronV6ProtocolV2; }
+
+    size_t encode(const LEDFrame& frame, std::vector<Report>* out) { return encodeFrame(frame, out); }
+    size_t encode(const ColFrame& frame, std::vector<Report>* out) { return encodeFrame(frame, out); }
+};
+
+// v2: [start runs (length r g b) * runs]... each run covers length consecutive entries of one colour
+template<typename Traits>
+class KeychronRLEEncoder : public KeychronEncoder<Traits> {
+private:
+    typedef typename KeychronEncoder<Traits>::Report Report;
+    typedef typename KeychronEncoder<Traits>::LEDFrame LEDFrame;
+    typedef typename KeychronEncoder<Traits>::ColFrame ColFrame;
+
+    template<size_t N>
+    size_t encodeFrame(const BasicFrame<N>& frame, std::vector<Report>* out) {
+        KeychronReportWriter<Traits> writer(out, id_custom_set_value, Traits::RLE_CHANNELS[this->template target<N>()]);
+
+        size_t i = 0;
+        while(i < N) {
+            if(!frame.mask.test(i)) {
+                i++;
+                continue;
+            }
+
+            writer.reserve(2 + 1 + sizeof(RGB));
+            writer.put((uint8_t)i);
+
+            size_t runsAt = writer.position();
+            writer.put((uint8_t)0);
+
+            uint8_t runs = 0;
+            while(i < N && frame.mask.test(i) && writer.remaining() >= 1 + sizeof(RGB)) {
+                RGB rgb = frame.colors[i];
+
+                size_t length = 0;
+                while(
+                    i < N && length < 0xFF && frame.mask.test(i) &&
+                    frame.colors[i].red == rgb.red && frame.colors[i].green == rgb.green && frame.colors[i].blue == rgb.blue
+                ) {
+                    i++;
+                    length++;
+                }
+
+                writer.put((uint8_t)length);
+                writer.put(rgb);
+                runs++;
+            }
+
+            writer.patch(runsAt, runs);
+        }
+
+        return writer.finish();
+    }
+
+public:
+    const char* name() { return "rle"; }
+    uint8_t protocolVersion() { return KeychronV6ProtocolV2; }
+
+    size_t encode(const LEDFrame& frame, std::vector<Report>* out) { return encodeFrame(frame, out); }
+    size_t encode(const ColFrame& frame, std::vector<Report>* out) { return encodeFrame(frame, out); }
+};
+
+// v3: palette entries as [start count (r g b) * count]... on the palette channel, then
+// [start count index * count]... with one byte per led, or a nibble per led when the palette fits in 16.
+// the firmware keeps its palette so only entries that changed since the last frame are resent
+template<typename Traits>
+class KeychronPaletteEncoder : public KeychronEncoder<Traits> {
+private:
+    typedef typename KeychronEncoder<Traits>::Report Report;
+    typedef typename KeychronEncoder<Traits>::LEDFrame LEDFrame;
+    typedef typename KeychronEncoder<Traits>::ColFrame ColFrame;
+
+    // 0xFF ends a palette report
+    static constexpr size_t MAX_PALETTE_SIZE = 0xFF;
+    static constexpr size_t NIBBLE_PALETTE_SIZE = 16;
+
+    uint8_t maxError;
+
+    // what the firmware has
+    RGB palette[MAX_PALETTE_SIZE];
+    size_t paletteSize;
+
+    // built for the frame being encoded
+    RGB pendingPalette[MAX_PALETTE_SIZE];
+    size_t pendingSize;
+    std::bitset<MAX_PALETTE_SIZE> changed;
+    uint8_t indices[Traits::LEDS];
+
+    bool matches(RGB a, RGB b) {
+        return
+            std::abs(a.red - b.red) <= maxError &&
+            std::abs(a.green - b.green) <= maxError &&
+            std::abs(a.blue - b.blue) <= maxError;
+    }
+
+    // maps every masked entry of frame to a palette index, reusing what the firmware has where possible
+    bool build(const LEDFrame& frame, size_t capacity) {
+        pendingSize = std::min(paletteSize, capacity);
+        std::memcpy(pendingPalette, palette, pendingSize * sizeof(RGB));
+
+        std::bitset<MAX_PALETTE_SIZE> used;
+        std::bitset<Traits::LEDS> unresolved;
+        changed.reset();
+
+        for(size_t i = 0; i < Traits::LEDS; i++) {
+            if(!frame.mask.test(i)) continue;
+
+            unresolved.set(i);
+            for(size_t j = 0; j < pendingSize; j++) {
+                if(!matches(frame.colors[i], pendingPalette[j])) continue;
+
+                indices[i] = j;
+                used.set(j);
+                unresolved.reset(i);
+
+                break;
+            }
+        }
+
+        // new colours go in free slots, then over entries this frame does not use
+        size_t freeSlot = 0;
+        for(size_t i = 0; i < Traits::LEDS; i++) {
+            if(!unresolved.test(i)) continue;
+
+            bool found = false;
+            for(size_t j = 0; j < pendingSize; j++) {
+                if(!used.test(j) || !matches(frame.colors[i], pendingPalette[j])) continue;
+
+                indices[i] = j;
+                found = true;
+
+                break;
+            }
+
+            if(found) continue;
+
+            size_t slot;
+            if(pendingSize < capacity) {
+                slot = pendingSize++;
+            }
+            else {
+                while(freeSlot < pendingSize && used.test(freeSlot)) freeSlot++;
+                if(freeSlot >= pendingSize) return false;
+
+                slot = freeSlot;
+            }
+
+            pendingPalette[slot] = frame.colors[i];
+            used.set(slot);
+            changed.set(slot);
+
+            indices[i] = slot;
+        }
+
+        return true;
+    }
+
+public:
+    // maxError is how far each channel of a colour may be from its palette entry, 0 keeps colours exact
+    KeychronPaletteEncoder(uint8_t maxError = 0) : maxError(maxError) {
+        reset();
+    }
+
+    const char* name() { return "palette"; }
+    uint8_t protocolVersion() { return KeychronV6ProtocolV3; }
+
+    bool supports(KeychronV6Target target) { return target == TARGET_LEDS; }
+
+    void reset() {
+        paletteSize = 0;
+    }
+
+    // the reports only carry the palette entries the firmware does not have yet
+    bool stateless() { return false; }
+
+    // the firmware only has indexed leds
+    size_t encode(const ColFrame&, std::vector<Report>*) { return SIZE_MAX; }
+
+    size_t encode(const LEDFrame& frame, std::vector<Report>* out) {
+        bool nibbles = build(frame, NIBBLE_PALETTE_SIZE);
+        if(!nibbles && !build(frame, MAX_PALETTE_SIZE)) {
+            return SIZE_MAX;
+        }
+
+        KeychronReportWriter<Traits> paletteWriter(out, id_custom_set_value, Traits::PALETTE_CHANNEL);
+
+        size_t i = 0;
+        while(i < pendingSize) {
+            if(!changed.test(i)) {
+                i++;
+                continue;
+            }
+
+            paletteWriter.reserve(2 + sizeof(RGB));
+            paletteWriter.put((uint8_t)i);
+
+            size_t countAt = paletteWriter.position();
+            paletteWriter.put((uint8_t)0);
+
+            uint8_t count = 0;
+            while(i < pendingSize && changed.test(i) && paletteWriter.remaining() >= sizeof(RGB)) {
+                paletteWriter.put(pendingPalette[i++]);
+                count++;
+            }
+
+            paletteWriter.patch(countAt, count);
+        }
+
+        size_t reports = paletteWriter.finish();
+
+        KeychronReportWriter<Traits> indexWriter(out, id_custom_set_value, nibbles ? Traits::INDEXED4_CHANNELS[TARGET_LEDS] : Traits::INDEXED_CHANNELS[TARGET_LEDS]);
+
+        i = 0;
+        while(i < Traits::LEDS) {
+            if(!frame.mask.test(i)) {
+                i++;
+                continue;
+            }
+
+            indexWriter.reserve(2 + 1);
+            indexWriter.put((uint8_t)i);
+
+            size_t countAt = indexWriter.position();
+            indexWriter.put((uint8_t)0);
+
+            uint8_t count = 0;
+            while(i < Traits::LEDS && frame.mask.test(i) && indexWriter.remaining() >= 1 && count < 0xFE) {
+                uint8_t byte = indices[i++];
+                count++;
+
+                // low nibble first
+                if(nibbles && i < Traits::LEDS && frame.mask.test(i)) {
+                    byte |= indices[i++] << 4;
+                    count++;
+                }
+
+                indexWriter.put(byte);
+            }
+
+            indexWriter.patch(countAt, count);
+        }
+
+        reports += indexWriter.finish();
+
+        if(out) {
+            std::memcpy(palette, pendingPalette, pendingSize * sizeof(RGB));
+            paletteSize = pendingSize;
+        }
+
+        return reports;
+    }
+};
+
+typedef KeychronReportWriter<KeychronV6Traits> KeychronV6ReportWriter;
+typedef KeychronEncoder<KeychronV6Traits> KeychronV6Encoder;
+typedef KeychronArrayEncoder<KeychronV6Traits> KeychronV6ArrayEncoder;
+typedef KeychronPackedEncoder<KeychronV6Traits> KeychronV6PackedEncoder;
+typedef KeychronRLEEncoder<KeychronV6Traits> KeychronV6RLEEncoder;
+typedef KeychronPaletteEncoder<KeychronV6Traits> KeychronV6PaletteEncoder;
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef __KEYCHRON_V6_PROTOCOL_HPP__
+#define __KEYCHRON_V6_PROTOCOL_HPP__
+
+#include "../../util/frame.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+// version of the custom channels reported by id_custom_protocol_channel.
+// firmware without that channel only speaks version 1
+const uint8_t KeychronV6ProtocolV1 = 1;
+const uint8_t KeychronV6ProtocolV2 = 2;
+const uint8_t KeychronV6ProtocolV3 = 3;
+// effect readback on id_custom_set_effect_channel and in the draw reply
+const uint8_t KeychronV6ProtocolV4 = 4;
+
+enum KeychronV6PacketCommands {
+    id_get_protocol_version                 = 0x01, // always 0x01
+    id_get_keyboard_value                   = 0x02,
+    id_set_keyboard_value                   = 0x03,
+    id_dynamic_keymap_get_keycode           = 0x04,
+    id_dynamic_keymap_set_keycode           = 0x05,
+    id_dynamic_keymap_reset                 = 0x06,
+    id_custom_set_value                     = 0x07,
+    id_custom_get_value                     = 0x08,
+    id_custom_save                          = 0x09,
+    id_eeprom_reset                         = 0x0A,
+    id_bootloader_jump                      = 0x0B,
+    id_dynamic_keymap_macro_get_count       = 0x0C,
+    id_dynamic_keymap_macro_get_buffer_size = 0x0D,
+    id_dynamic_keymap_macro_get_buffer      = 0x0E,
+    id_dynamic_keymap_macro_set_buffer      = 0x0F,
+    id_dynamic_keymap_macro_reset           = 0x10,
+    id_dynamic_keymap_get_layer_count       = 0x11,
+    id_dynamic_keymap_get_buffer            = 0x12,
+    id_dynamic_keymap_set_buffer            = 0x13,
+    id_dynamic_keymap_get_encoder           = 0x14,
+    id_dynamic_keymap_set_encoder           = 0x15,
+    id_unhandled                            = 0xFF,
+};
+
+enum KeychronV6PacketChannels {
+    id_custom_channel            = 0,
+    id_qmk_backlight_channel     = 1,
+    id_qmk_rgblight_channel      = 2,
+    id_qmk_rgb_matrix_channel    = 3,
+    id_qmk_audio_channel         = 4,
+    id_custom_set_effect_channel = 5,
+    id_custom_array_led_channel  = 6,
+    id_custom_single_led_channel = 7,
+    id_custom_single_col_channel = 8,
+    id_custom_array_col_channel  = 9,
+    id_custom_draw_channel       = 10,
+    // protocol v2
+    id_custom_protocol_channel   = 11,
+    id_custom_packed_led_channel = 12,
+    id_custom_packed_col_channel = 13,
+    id_custom_rle_led_channel    = 14,
+    id_custom_rle_col_channel    = 15,
+    // protocol v3
+    id_custom_palette_channel      = 16,
+    id_custom_indexed_led_channel  = 17,
+    id_custom_indexed4_led_channel = 18,
+};
+
+// which index space a frame is addressed in
+enum KeychronV6Target {
+    TARGET_LEDS = 0,
+    TARGET_COLS
+};
+
+// everything about the keyboard that is fixed at compile time.
+// the encoders and framebuffers are templates over this, so another board speaking
+// the same protocol only needs its own traits
+struct KeychronV6Traits {
+    static constexpr size_t PAYLOAD_LENGTH = 32;
+    // report id + raw hid payload
+    static constexpr size_t REPORT_LENGTH = PAYLOAD_LENGTH + 1;
+
+    static constexpr size_t LEDS = 108;
+    static constexpr size_t COLS = 22;
+    static constexpr size_t ROWS = 6;
+
+    // the channel of every encoding, indexed by target. 0xFF where the firmware has none
+    static constexpr uint8_t ARRAY_CHANNELS[2] = { id_custom_array_led_channel, id_custom_array_col_channel };
+    static constexpr uint8_t PACKED_CHANNELS[2] = { id_custom_packed_led_channel, id_custom_packed_col_channel };
+    static constexpr uint8_t RLE_CHANNELS[2] = { id_custom_rle_led_channel, id_custom_rle_col_channel };
+    static constexpr uint8_t INDEXED_CHANNELS[2] = { id_custom_indexed_led_channel, 0xFF };
+    static constexpr uint8_t INDEXED4_CHANNELS[2] = { id_custom_indexed4_led_channel, 0xFF };
+    static constexpr uint8_t PALETTE_CHANNEL = id_custom_palette_channel;
+
+    typedef std::array<uint8_t, REPORT_LENGTH> Report;
+
+    // the encoders tell the targets apart by frame type
+    typedef BasicFrame<LEDS> LEDFrame;
+    typedef BasicFrame<COLS> ColFrame;
+};
+
+const size_t KeychronV6PayloadLength = KeychronV6Traits::PAYLOAD_LENGTH;
+const size_t KeychronV6TotalLEDs = KeychronV6Traits::LEDS;
+
+typedef KeychronV6Traits::Report KeychronV6Report;
+
+#endif
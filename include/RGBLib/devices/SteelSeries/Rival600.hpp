@@ -1,88 +1,317 @@
-#ifndef __RIVAL600_HPP__
-#define __RIVAL600_HPP__
-
-#include "../mouse.hpp"
-#include "../../util/bytes.hpp"
-
-#include <hidapi/hidapi.h>
-
-const std::vector<std::vector<uint8_t>> Rival600LEDS = {
-    { 0x02, 0x00, 0x03 },
-    { 0x04, 0x05, },
-    { 0x06, 0x01, 0x07 }
-};
-
-enum RIVAL600COMMANDS {
-    SET_LED_COLOR = 0x05,
-    SAVE = 0x09
-};
-
-
-class Rival600 : public Mouse {
-public:
-    Rival600() : Mouse(0x1038, 0x1724, 0x00, 0x00, Rival600LEDS, [this]() -> void {}) {}
-    virtual ~Rival600() {}
-
-    void set_led(uint8_t led, RGB rgb) {
-        if(!device) return;
-
-#define HEADER_LENGTH 28
-#define BODY_LENGTH 7
-#define REPEAT_INDEX 22
-#define TRIGGERS_INDEX 23
-#define COLOURS_COUNT_INDEX 27
-#define DURATION_INDEX 6
-#define DURATION_LENGTH 2
-#define DEFAULT_DURATION 1000
-#define REPORT_LENGTH 3
-
-        unsigned char header[HEADER_LENGTH];
-        for(int i = 0; i < HEADER_LENGTH; i++) {
-            header[i] = 0.0f;
-        }
-
-        header[REPEAT_INDEX] = 0x01;
-        header[COLOURS_COUNT_INDEX] = 0x01; // gradient count(1)
-
-        // led id indices
-        header[0] = led;
-        header[5] = led;
-
-        // duration must be in little endian so swap bytes
-        header[DURATION_INDEX] = DEFAULT_DURATION >> 8;
-        header[DURATION_INDEX + 1] = DEFAULT_DURATION & 0xFF;
-
-
-        unsigned char body[BODY_LENGTH]; // rgb rgb offset
-
-        // rgb
-        body[0] = rgb.red;
-        body[1] = rgb.green;
-        body[2] = rgb.blue;
-        // rgb
-        body[3] = rgb.red;
-        body[4] = rgb.green;
-        body[5] = rgb.blue;
-        // offset
-        body[6] = 0;
-
-        unsigned char data[HEADER_LENGTH + BODY_LENGTH];
-        size_t dataLen = merge_bytes(header, HEADER_LENGTH, body, BODY_LENGTH, data);
-
-        unsigned char report[REPORT_LENGTH];
-        report[0] = 0x00; // reportid
-        report[1] = RIVAL600COMMANDS::SET_LED_COLOR; // command
-        report[2] = 0x00; // command
-
-        unsigned char payload[REPORT_LENGTH + dataLen];
-        size_t payloadLen = merge_bytes(report, REPORT_LENGTH, data, dataLen, payload);
-
-        if(!deviceMutex.try_lock()) return;
-
-        hid_send_feature_report(device, payload, payloadLen * sizeof(unsigned char));
-
-        deviceMutex.unlock();
-    }
-};
-
-#endif
+#ifndef __RIVAL600_HPP__
+#define __RIVAL600_HPP__
+
+#include "../mouse.hpp"
+#include "../../util/bytes.hpp"
+
+#include <hidapi/hidapi.h>
+#include <math.h>
+
+#include <mutex>
+#include <atomic>
+#include <bitset>
+#include <algorithm>
+
+const std::vector<std::vector<uint8_t>> Rival600LEDS = {
+    { 0x02, 0x00, 0x03 },
+    { 0x04, 0x05, },
+    { 0x06, 0x01, 0x07 }
+};
+
+const uint8_t Rival600TotalLEDs = 8;
+
+// the most colours one report can carry
+const size_t Rival600MaxGradientStops = 14;
+
+struct GradientStop {
+    RGB color;
+    // 0 to 1 through the duration
+    float position;
+};
+
+// rough zone positions in led order in key units, the mouse is about 3.5u wide and 7u long.
+// the wheel, the logo, then the side strips from the front with the left one first
+const std::vector<KeyRect> Rival600Keys = {
+    { 1.5, 0.5, 0.5, 1 },
+    { 1.25, 4.5, 1, 1 },
+    { 0, 1, 0.5, 1.5 },   { 3, 1, 0.5, 1.5 },
+    { 0, 2.5, 0.5, 1.5 }, { 3, 2.5, 0.5, 1.5 },
+    { 0, 4, 0.5, 1.5 },   { 3, 4, 0.5, 1.5 },
+};
+
+enum RIVAL600COMMANDS {
+    SET_LED_COLOR = 0x05,
+    SAVE = 0x09
+};
+
+
+class Rival600 : public Mouse {
+private:
+    // what the mouse shows, colours waiting to be sent and which zones they are for.
+    // guarded by stateMutex so queueing never waits on a feature report
+    std::mutex stateMutex;
+    RGB sent[Rival600TotalLEDs];
+    RGB pending[Rival600TotalLEDs];
+    std::bitset<Rival600TotalLEDs> known;
+    std::bitset<Rival600TotalLEDs> dirty;
+
+    // the gradient each zone is running, if it was set with set_gradient
+    struct Gradient {
+        GradientStop stops[Rival600MaxGradientStops];
+        size_t count;
+        uint16_t durationMs;
+        bool repeat;
+    };
+
+    Gradient gradients[Rival600TotalLEDs];
+    std::bitset<Rival600TotalLEDs> gradientKnown;
+
+    static constexpr uint16_t DEFAULT_DURATION = 1000;
+
+    // cleared on connect, the mouse may show anything after being plugged back in
+    std::atomic<bool> stateValid;
+
+    // deviceMutex must be held, the zone blends through the stops over durationMs
+    bool send_gradient(uint8_t led, const GradientStop* stops, size_t count, uint16_t durationMs, bool repeat) {
+#define HEADER_LENGTH 28
+#define STOP_LENGTH 4
+#define REPEAT_INDEX 22
+#define TRIGGERS_INDEX 23
+#define COLOURS_COUNT_INDEX 27
+#define DURATION_INDEX 6
+#define DURATION_LENGTH 2
+#define REPORT_LENGTH 3
+
+        if(count == 0 || count > Rival600MaxGradientStops) return false;
+
+        unsigned char header[HEADER_LENGTH];
+        for(int i = 0; i < HEADER_LENGTH; i++) {
+            header[i] = 0.0f;
+        }
+
+        header[REPEAT_INDEX] = repeat ? 0x01 : 0x00;
+        header[COLOURS_COUNT_INDEX] = count; // gradient count
+
+        // led id indices
+        header[0] = led;
+        header[5] = led;
+
+        // duration is little endian
+        header[DURATION_INDEX] = durationMs & 0xFF;
+        header[DURATION_INDEX + 1] = durationMs >> 8;
+
+
+        // starting rgb then rgb offset for every stop, offsets are from the previous stop out of 255
+        unsigned char body[3 + STOP_LENGTH * Rival600MaxGradientStops];
+        size_t bodyLen = 0;
+
+        body[bodyLen++] = stops[0].color.red;
+        body[bodyLen++] = stops[0].color.green;
+        body[bodyLen++] = stops[0].color.blue;
+
+        int previous = 0;
+        for(size_t i = 0; i < count; i++) {
+            int position = (int)lroundf(std::clamp(stops[i].position, 0.0f, 1.0f) * 255.0f);
+
+            body[bodyLen++] = stops[i].color.red;
+            body[bodyLen++] = stops[i].color.green;
+            body[bodyLen++] = stops[i].color.blue;
+            body[bodyLen++] = (uint8_t)std::max(position - previous, 0);
+
+            previous = std::max(position, previous);
+        }
+
+        unsigned char data[HEADER_LENGTH + sizeof(body)];
+        size_t dataLen = merge_bytes(header, HEADER_LENGTH, body, bodyLen, data);
+
+        unsigned char report[REPORT_LENGTH];
+        report[0] = 0x00; // reportid
+        report[1] = RIVAL600COMMANDS::SET_LED_COLOR; // command
+        report[2] = 0x00; // command
+
+        unsigned char payload[REPORT_LENGTH + sizeof(data)];
+        size_t payloadLen = merge_bytes(report, REPORT_LENGTH, data, dataLen, payload);
+
+        return send_feature_report(payload, payloadLen * sizeof(unsigned char)) != -1;
+    }
+
+    // deviceMutex must be held, a one colour gradient
+    bool send_zone(uint8_t led, RGB rgb) {
+        GradientStop stop = { rgb, 0.0f };
+        return send_gradient(led, &stop, 1, DEFAULT_DURATION, true);
+    }
+
+    static bool same_gradient(const Gradient& a, const Gradient& b) {
+        if(a.count != b.count || a.durationMs != b.durationMs || a.repeat != b.repeat) return false;
+
+        for(size_t i = 0; i < a.count; i++) {
+            const RGB& colorA = a.stops[i].color;
+            const RGB& colorB = b.stops[i].color;
+
+            if(colorA.red != colorB.red || colorA.green != colorB.green || colorA.blue != colorB.blue) return false;
+            if(a.stops[i].position != b.stops[i].position) return false;
+        }
+
+        return true;
+    }
+
+    void queue(uint8_t led, RGB rgb) {
+        if(led >= Rival600TotalLEDs) return;
+
+        if(!stateValid.exchange(true)) {
+            known.reset();
+            gradientKnown.reset();
+        }
+
+        pending[led] = rgb;
+        gradientKnown.reset(led);
+
+        bool unchanged = known.test(led) && sent[led].red == rgb.red && sent[led].green == rgb.green && sent[led].blue == rgb.blue;
+        dirty.set(led, !unchanged);
+    }
+
+    // deviceMutex must be held, sends the latest colour of every zone that changed, one report each.
+    // false if the mouse is gone or a zone could not be sent
+    bool flush() {
+        if(!device) return false;
+
+        std::bitset<Rival600TotalLEDs> toSend;
+        RGB colors[Rival600TotalLEDs];
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+
+            toSend = dirty;
+            dirty.reset();
+            std::copy(pending, pending + Rival600TotalLEDs, colors);
+        }
+
+        bool flushed = true;
+        for(uint8_t led = 0; led < Rival600TotalLEDs; led++) {
+            if(!toSend.test(led)) continue;
+
+            bool ok = send_zone(led, colors[led]);
+            flushed = flushed && ok;
+
+            std::lock_guard<std::mutex> lock(stateMutex);
+            sent[led] = colors[led];
+            known.set(led, ok);
+
+            // tried again by the next flush rather than left stale until the colour changes
+            if(!ok) dirty.set(led);
+        }
+
+        return flushed;
+    }
+
+public:
+    Rival600() : Mouse(0x1038, 0x1724, 0x00, 0x00, Rival600LEDS, [this]() -> void {
+        this->stateValid = false;
+    }) {
+        geometry = DeviceGeometry(Rival600Keys);
+
+        stateValid = false;
+    }
+
+    virtual ~Rival600() {}
+
+    // skipped if the zone already shows rgb. if another thread is using the mouse
+    // the colour is kept and sent by the next set_led, set_leds or draw_frame
+    void set_led(uint8_t led, RGB rgb) {
+        if(!device) return;
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            queue(led, rgb);
+        }
+
+        if(!deviceMutex.try_lock()) return;
+
+        flush();
+
+        deviceMutex.unlock();
+    }
+
+    // colors[led] for the first count zones, only the zones that changed are sent.
+    // true once the mouse shows them, false if they were left queued or could not be sent
+    bool set_leds(const RGB* colors, size_t count) {
+        if(!device) return false;
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+
+            for(size_t led = 0; led < std::min<size_t>(count, Rival600TotalLEDs); led++) {
+                queue(led, colors[led]);
+            }
+        }
+
+        if(!deviceMutex.try_lock()) return false;
+
+        bool flushed = flush();
+
+        deviceMutex.unlock();
+
+        return flushed;
+    }
+
+    // uploads a gradient the mouse animates on its own, repeat loops it.
+    // skipped if the zone already runs the same one unless force, which restarts it to correct its phase.
+    // waits for the mouse, false if nothing could be sent
+    bool set_gradient(uint8_t led, const GradientStop* stops, size_t count, uint16_t durationMs, bool repeat, bool force = false) {
+        if(!device || led >= Rival600TotalLEDs || count == 0 || count > Rival600MaxGradientStops) return false;
+
+        Gradient gradient = {};
+        std::copy(stops, stops + count, gradient.stops);
+        gradient.count = count;
+        gradient.durationMs = durationMs;
+        gradient.repeat = repeat;
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+
+            if(!stateValid.exchange(true)) {
+                known.reset();
+                gradientKnown.reset();
+            }
+
+            if(!force && gradientKnown.test(led) && same_gradient(gradients[led], gradient)) return true;
+
+            // a queued colour would overwrite the gradient
+            dirty.reset(led);
+        }
+
+        deviceMutex.lock();
+        bool ok = device && send_gradient(led, stops, count, durationMs, repeat);
+        deviceMutex.unlock();
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+
+        gradients[led] = gradient;
+        gradientKnown.set(led, ok);
+        // a flush that failed while this waited for the mouse queues its colour again
+        dirty.reset(led);
+        // the zone no longer shows a single colour
+        known.reset(led);
+
+        return ok;
+    }
+
+    // false once the mouse reconnected or a zone was given a colour since its gradient
+    bool has_gradients() {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return stateValid && gradientKnown.all();
+    }
+
+    // waits for the mouse and sends anything still queued, false if it could not all be sent
+    bool draw_frame() {
+        if(!device) return false;
+
+        deviceMutex.lock();
+        bool flushed = flush();
+        deviceMutex.unlock();
+
+        return flushed;
+    }
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef __RGBLIB_CANVAS_HPP__
+#define __RGBLIB_CANVAS_HPP__
+
+#include "../util/rgb.hpp"
+#include "./geometry.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+enum CanvasSampling {
+    // the 4 pixels around each led's centre
+    SAMPLING_BILINEAR = 0,
+    // every pixel under each led's key, weighted by how much of it is covered
+    SAMPLING_AREA
+};
+
+// float rgb image laid over a physical area that every device is placed on, row major, structure of arrays
+class Canvas {
+private:
+    size_t width;
+    size_t height;
+
+    float widthMM;
+    float heightMM;
+
+    std::vector<float> r;
+    std::vector<float> g;
+    std::vector<float> b;
+
+public:
+    Canvas(size_t width = 0, size_t height = 0, float widthMM = 0, float heightMM = 0) :
+        width(width), height(height), widthMM(widthMM), heightMM(heightMM), r(width * height), g(width * height), b(width * height) {}
+
+    size_t getWidth() const { return width; }
+    size_t getHeight() const { return height; }
+
+    float getWidthMM() const { return widthMM; }
+    float getHeightMM() const { return heightMM; }
+
+    float* red() { return r.data(); }
+    float* green() { return g.data(); }
+    float* blue() { return b.data(); }
+
+    const float* red() const { return r.data(); }
+    const float* green() const { return g.data(); }
+    const float* blue() const { return b.data(); }
+
+    void set(size_t x, size_t y, RGB rgb) {
+        if(x >= width || y >= height) return;
+
+        r[y * width + x] = rgb.red;
+        g[y * width + x] = rgb.green;
+        b[y * width + x] = rgb.blue;
+    }
+
+    void fill(RGB rgb) {
+        std::fill(r.begin(), r.end(), (float)rgb.red);
+        std::fill(g.begin(), g.end(), (float)rgb.green);
+        std::fill(b.begin(), b.end(), (float)rgb.blue);
+    }
+};
+
+// how one device's leds read the canvas, built once from its geometry.
+// a sparse matrix with a row of pixel weights per led, compressed sparse rows
+class CanvasSampler {
+private:
+    size_t ledCount;
+
+    // row of led is rowStarts[led] up to rowStarts[led + 1]
+    std::vector<uint32_t> rowStarts;
+    std::vector<uint32_t> pixels;
+    std::vector<float> weights;
+
+    void addBilinear(const Canvas& canvas, float x, float y) {
+        float u = std::clamp(x * canvas.getWidth() / canvas.getWidthMM() - 0.5f, 0.0f, (float)(canvas.getWidth() - 1));
+        float v = std::clamp(y * canvas.getHeight() / canvas.getHeightMM() - 0.5f, 0.0f, (float)(canvas.getHeight() - 1));
+
+        size_t x0 = (size_t)u;
+        size_t y0 = (size_t)v;
+        size_t x1 = std::min(x0 + 1, canvas.getWidth() - 1);
+        size_t y1 = std::min(y0 + 1, canvas.getHeight() - 1);
+
+        float fx = u - x0;
+        float fy = v - y0;
+
+        add(y0 * canvas.getWidth() + x0, (1.0f - fx) * (1.0f - fy));
+        add(y0 * canvas.getWidth() + x1, fx * (1.0f - fy));
+        add(y1 * canvas.getWidth() + x0, (1.0f - fx) * fy);
+        add(y1 * canvas.getWidth() + x1, fx * fy);
+    }
+
+    // false if the key is entirely off the canvas
+    bool addArea(const Canvas& canvas, float x, float y, float w, float h) {
+        float pixelW = canvas.getWidthMM() / canvas.getWidth();
+        float pixelH = canvas.getHeightMM() / canvas.getHeight();
+
+        float left = std::max((x - w / 2.0f) / pixelW, 0.0f);
+        float right = std::min((x + w / 2.0f) / pixelW, (float)canvas.getWidth());
+        float top = std::max((y - h / 2.0f) / pixelH, 0.0f);
+        float bottom = std::min((y + h / 2.0f) / pixelH, (float)canvas.getHeight());
+
+        if(left >= right || top >= bottom) return false;
+
+        size_t start = pixels.size();
+        float total = 0.0f;
+
+        for(size_t py = (size_t)top; (float)py < bottom; py++) {
+            float coverH = std::min(bottom, py + 1.0f) - std::max(top, (float)py);
+
+            for(size_t px = (size_t)left; (float)px < right; px++) {
+                float coverW = std::min(right, px + 1.0f) - std::max(left, (float)px);
+
+                add(py * canvas.getWidth() + px, coverW * coverH);
+                total += coverW * coverH;
+            }
+        }
+
+        for(size_t i = start; i < weights.size(); i++) {
+            weights[i] /= total;
+        }
+
+        return true;
+    }
+
+    void add(size_t pixel, float weight) {
+        if(weight <= 0.0f) return;
+
+        pixels.push_back((uint32_t)pixel);
+        weights.push_back(weight);
+    }
+
+public:
+    CanvasSampler() : ledCount(0), rowStarts({ 0 }) {}
+
+    // offsetX and offsetY place the device's top left corner on the canvas, in mm
+    CanvasSampler(const Canvas& canvas, const DeviceGeometry& geometry, float offsetX, float offsetY, CanvasSampling sampling) : CanvasSampler() {
+        if(canvas.getWidth() == 0 || canvas.getHeight() == 0) return;
+
+        ledCount = geometry.getLEDCount();
+        for(size_t led = 0; led < ledCount; led++) {
+            float x = offsetX + geometry.getX(led);
+            float y = offsetY + geometry.getY(led);
+
+            if(sampling != SAMPLING_AREA || !addArea(canvas, x, y, geometry.getW(led), geometry.getH(led))) {
+                addBilinear(canvas, x, y);
+            }
+
+            rowStarts.push_back((uint32_t)pixels.size());
+        }
+    }
+
+    size_t getLEDCount() const { return ledCount; }
+    size_t getWeightCount() const { return weights.size(); }
+
+    // one sparse matrix vector product per channel
+    void sample(const Canvas& canvas, RGB* out, size_t count) const {
+        count = std::min(count, ledCount);
+
+        const float* r = canvas.red();
+        const float* g = canvas.green();
+        const float* b = canvas.blue();
+
+        for(size_t led = 0; led < count; led++) {
+            float red = 0.0f;
+            float green = 0.0f;
+            float blue = 0.0f;
+
+            for(uint32_t i = rowStarts[led]; i < rowStarts[led + 1]; i++) {
+                red += r[pixels[i]] * weights[i];
+                green += g[pixels[i]] * weights[i];
+                blue += b[pixels[i]] * weights[i];
+            }
+
+            out[led] = {
+                (uint8_t)std::clamp(red + 0.5f, 0.0f, 255.0f),
+                (uint8_t)std::clamp(green + 0.5f, 0.0f, 255.0f),
+                (uint8_t)std::clamp(blue + 0.5f, 0.0f, 255.0f)
+            };
+        }
+    }
+};
+
+// a canvas drawn on one thread and sampled from others.
+// the drawing thread fills getBack() and publishes it, samplers always read a whole frame
+class CanvasBuffer {
+private:
+    Canvas canvases[2];
+    size_t front;
+
+    std::mutex mutex;
+
+public:
+    CanvasBuffer(size_t width, size_t height, float widthMM, float heightMM) : front(0) {
+        canvases[0] = Canvas(width, height, widthMM, heightMM);
+        canvases[1] = Canvas(width, height, widthMM, heightMM);
+    }
+
+    // the layout both canvases share
+    const Canvas& getLayout() { return canvases[0]; }
+
+    // only the drawing thread may touch this
+    Canvas& getBack() { return canvases[1 - front]; }
+
+    void publish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        front = 1 - front;
+    }
+
+    void sample(const CanvasSampler& sampler, RGB* out, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        sampler.sample(canvases[front], out, count);
+    }
+};
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef __RGBLIB_DESCRIPTION_HPP__
+#define __RGBLIB_DESCRIPTION_HPP__
+
+#include "../util/json.hpp"
+#include "./geometry.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <libevdev-1.0/libevdev/libevdev.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+
+// a device's ids, reports and layout read from a json file instead of a driver's header.
+// the driver named decides what it accepts, keychron-v6 only takes layouts shaped like the V6, see KeychronV6::accepts.
+// it is compiled once into the same dense tables the drivers build from their constants:
+//
+// {
+//     "name": "Keychron V6",
+//     "driver": "keychron-v6",
+//     "vendor_id": "0x3434", "product_id": "0x0361", "usage_page": "0xFF60", "usage": "0x61",
+//     "report_length": 33,
+//     "channels": [ "array", "packed", "rle", "palette" ],
+//     "leds": [ [ 0, 1, null, 2 ], ... ],      led of each key by [row][col], null has none
+//     "keys": [ [ x, y, w, h ], ... ],          in led order, in key units
+//     "keycodes": [ "KEY_ESC", null, ... ]      in led order, evdev names, null has no key
+// }
+struct DeviceDescription {
+    std::string name;
+    // the driver the tables are for, it checks they fit what it was compiled for
+    std::string driver;
+
+    unsigned int vendorId = 0;
+    unsigned int productId = 0;
+    unsigned int usagePage = 0;
+    unsigned int usage = 0;
+
+    // report id + payload
+    size_t reportLength = 0;
+    // encodings the firmware decodes, in the order they are preferred on equal cost
+    std::vector<std::string> channels;
+
+    size_t ledCount = 0;
+    size_t rows = 0;
+    size_t cols = 0;
+
+    // [row][col], every row cols long, 0xFF has no led
+    std::vector<std::vector<uint8_t>> leds;
+    // in led order
+    std::vector<KeyRect> keys;
+    // led of every evdev key code up to KEY_MAX, 0xFF has none
+    std::vector<uint8_t> keyLEDs;
+
+    bool hasChannel(const char* channel) const {
+        for(const std::string& name : channels) {
+            if(name == channel) return true;
+        }
+
+        return false;
+    }
+
+    // keyLEDs from the key code of every led, 0xFF has none. the first led with a code wins
+    void setKeyCodes(const uint16_t* codes, size_t count) {
+        keyLEDs = std::vector<uint8_t>(KEY_CNT, 0xFF);
+
+        for(size_t led = 0; led < count; led++) {
+            if(codes[led] < KEY_CNT && keyLEDs[codes[led]] == 0xFF) keyLEDs[codes[led]] = (uint8_t)led;
+        }
+    }
+
+    // checks everything in json and fills out, false with the first problem in error
+    static bool compile(const JSONValue& json, DeviceDescription& out, std::string& error) {
+        out = DeviceDescription();
+
+        if(!json.isObject()) {
+            error = "not an object";
+            return false;
+        }
+
+        if(!getString(json, "name", out.name, error) || !getString(json, "driver", out.driver, error)) return false;
+
+        if(
+            !getID(json, "vendor_id", out.vendorId, error) || !getID(json, "product_id", out.productId, error) ||
+            !getID(json, "usage_page", out.usagePage, error) || !getID(json, "usage", out.usage, error)
+        ) {
+            return false;
+        }
+
+        const JSONValue* reportLength = json.get("report_length");
+        if(!reportLength || !reportLength->isNumber() || reportLength->number < 1 || reportLength->number > 4096 || reportLength->number != floor(reportLength->number)) {
+            error = "report_length has to be a whole number of bytes";
+            return false;
+        }
+
+        out.reportLength = (size_t)reportLength->number;
+
+        const JSONValue* channels = json.get("channels");
+        if(channels) {
+            if(!channels->isArray()) {
+                error = "channels has to be an array";
+                return false;
+            }
+
+            for(const JSONValue& channel : channels->items) {
+                if(!channel.isString()) {
+                    error = "channels has to be names";
+                    return false;
+                }
+
+                out.channels.push_back(channel.string);
+            }
+        }
+
+        return compileLEDs(json, out, error) && compileKeys(json, out, error) && compileKeyCodes(json, out, error);
+    }
+
+    // reads, parses and compiles path, printing how long each took
+    static bool load(const char* path, DeviceDescription& out, std::string& error) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::ifstream stream(path);
+        if(!stream) {
+            error = std::string("cannot open ") + path;
+            return false;
+        }
+
+        std::stringstream text;
+        text << stream.rdbuf();
+
+        JSONParser parser;
+        JSONValue json;
+        if(!parser.parse(text.str(), json)) {
+            error = parser.getError();
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point parsed = std::chrono::steady_clock::now();
+
+        if(!compile(json, out, error)) return false;
+
+        std::chrono::steady_clock::time_point compiled = std::chrono::steady_clock::now();
+        printf(
+            "Loaded %s from %s: parsed in %lldus, compiled in %lldus\n", out.name.c_str(), path,
+            (long long)std::chrono::duration_cast<std::chrono::microseconds>(parsed - start).count(),
+            (long long)std::chrono::duration_cast<std::chrono::microseconds>(compiled - parsed).count()
+        );
+
+        return true;
+    }
+
+private:
+    static bool getString(const JSONValue& json, const char* key, std::string& out, std::string& error) {
+        const JSONValue* value = json.get(key);
+        if(!value || !value->isString() || value->string.empty()) {
+            error = std::string(key) + " has to be a string";
+            return false;
+        }
+
+        out = value->string;
+        return true;
+    }
+
+    // usb ids are a number or a "0x" hex string
+    static bool getID(const JSONValue& json, const char* key, unsigned int& out, std::string& error) {
+        const JSONValue* value = json.get(key);
+
+        long id = -1;
+        if(value && value->isNumber() && value->number == floor(value->number)) {
+            id = (long)value->number;
+        }
+        else if(value && value->isString()) {
+            char* end;
+            id = strtol(value->string.c_str(), &end, 0);
+
+            if(value->string.empty() || *end != '\0') id = -1;
+        }
+
+        if(id < 0 || id > 0xFFFF) {
+            error = std::string(key) + " has to be a 16 bit id";
+            return false;
+        }
+
+        out = (unsigned int)id;
+        return true;
+    }
+
+    static bool compileLEDs(const JSONValue& json, DeviceDescription& out, std::string& error) {
+        const JSONValue* leds = json.get("leds");
+        if(!leds || !leds->isArray() || leds->items.empty()) {
+            error = "leds has to be an array of rows";
+            return false;
+        }
+
+        out.rows = leds->items.size();
+        for(const JSONValue& row : leds->items) {
+            if(!row.isArray()) {
+                error = "leds has to be an array of rows";
+                return false;
+            }
+
+            out.cols = std::max(out.cols, row.items.size());
+        }
+
+        std::vector<bool> seen;
+        out.leds = std::vector<std::vector<uint8_t>>(out.rows, std::vector<uint8_t>(out.cols, 0xFF));
+
+        for(size_t row = 0; row < out.rows; row++) {
+            for(size_t col = 0; col < leds->items[row].items.size(); col++) {
+                const JSONValue& led = leds->items[row].items[col];
+                if(led.isNull()) continue;
+
+                if(!led.isNumber() || led.number < 0 || led.number > 254 || led.number != floor(led.number)) {
+                    error = "leds row " + std::to_string(row) + " col " + std::to_string(col) + " has to be an led from 0 to 254 or null";
+                    return false;
+                }
+
+                size_t index = (size_t)led.number;
+                if(index >= seen.size()) seen.resize(index + 1, false);
+
+                if(seen[index]) {
+                    error = "led " + std::to_string(index) + " is in leds twice";
+                    return false;
+                }
+
+                seen[index] = true;
+                out.leds[row][col] = (uint8_t)index;
+            }
+        }
+
+        // leds are array indices everywhere, so there can be no gaps
+        for(size_t led = 0; led < seen.size(); led++) {
+            if(seen[led]) continue;
+
+            error = "led " + std::to_string(led) + " is missing from leds";
+            return false;
+        }
+
+        out.ledCount = seen.size();
+        return true;
+    }
+
+    static bool compileKeys(const JSONValue& json, DeviceDescription& out, std::string& error) {
+        const JSONValue* keys = json.get("keys");
+        if(!keys || !keys->isArray() || keys->items.size() != out.ledCount) {
+            error = "keys has to have one [ x, y, w, h ] per led";
+            return false;
+        }
+
+        out.keys.reserve(out.ledCount);
+        for(size_t led = 0; led < out.ledCount; led++) {
+            const JSONValue& key = keys->items[led];
+
+            bool valid = key.isArray() && key.items.size() == 4;
+            for(size_t i = 0; valid && i < 4; i++) {
+                valid = key.items[i].isNumber() && key.items[i].number >= 0 && (i < 2 || key.items[i].number > 0);
+            }
+
+            if(!valid) {
+                error = "key of led " + std::to_string(led) + " has to be [ x, y, w, h ] with a positive size";
+                return false;
+            }
+
+            out.keys.push_back({ (float)key.items[0].number, (float)key.items[1].number, (float)key.items[2].number, (float)key.items[3].number });
+        }
+
+        return true;
+    }
+
+    static bool compileKeyCodes(const JSONValue& json, DeviceDescription& out, std::string& error) {
+        const JSONValue* keycodes = json.get("keycodes");
+        if(!keycodes || !keycodes->isArray() || keycodes->items.size() != out.ledCount) {
+            error = "keycodes has to have one evdev key name or null per led";
+            return false;
+        }
+
+        std::vector<uint16_t> codes(out.ledCount, 0xFFFF);
+        for(size_t led = 0; led < out.ledCount; led++) {
+            const JSONValue& name = keycodes->items[led];
+            if(name.isNull()) continue;
+
+            int code = name.isString() ? libevdev_event_code_from_name(EV_KEY, name.string.c_str()) : -1;
+            if(code < 0 || code >= KEY_CNT) {
+                error = "keycode of led " + std::to_string(led) + " is not an evdev key name";
+                return false;
+            }
+
+            codes[led] = (uint16_t)code;
+        }
+
+        out.setKeyCodes(codes.data(), codes.size());
+        return true;
+    }
+};
+
+#endif
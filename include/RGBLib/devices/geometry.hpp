@@ -0,0 +1,165 @@
+#ifndef __RGBLIB_GEOMETRY_HPP__
+#define __RGBLIB_GEOMETRY_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+// one key in key units (1u = 19.05mm) from the top left of the board, led order
+struct KeyRect {
+    float x;
+    float y;
+    float w;
+    float h;
+};
+
+// physical led positions with every pairwise lookup precomputed at load.
+// everything is stored structure of arrays in uint16_t, distances and positions
+// in GEOMETRY_SCALE units per mm and angles as a full turn over 65536
+class DeviceGeometry {
+public:
+    static constexpr float KEY_UNIT_MM = 19.05f;
+    static constexpr float GEOMETRY_SCALE = 100.0f;
+
+    static constexpr size_t MAX_NEIGHBOURS = 8;
+    static constexpr uint8_t NO_NEIGHBOUR = 0xFF;
+
+private:
+    size_t ledCount;
+
+    float width;
+    float height;
+
+    // positions
+    std::vector<uint16_t> x;
+    std::vector<uint16_t> y;
+
+    // size of each led's key
+    std::vector<uint16_t> w;
+    std::vector<uint16_t> h;
+
+    // [from * ledCount + to]
+    std::vector<uint16_t> distances;
+    std::vector<uint16_t> angles;
+
+    // from the centre of the bounding box
+    std::vector<uint16_t> centreDistances;
+    std::vector<uint16_t> centreAngles;
+
+    // [led * MAX_NEIGHBOURS + i], closest first, NO_NEIGHBOUR padded
+    std::vector<uint8_t> neighbours;
+
+    static uint16_t toDistance(float mm) {
+        return (uint16_t)std::min(mm * GEOMETRY_SCALE + 0.5f, 65535.0f);
+    }
+
+    static uint16_t toAngle(float dx, float dy) {
+        float turn = atan2f(dy, dx) / (2.0f * (float)M_PI);
+        if(turn < 0.0f) turn += 1.0f;
+
+        return (uint16_t)((uint32_t)(turn * 65536.0f) & 0xFFFF);
+    }
+
+public:
+    DeviceGeometry() : ledCount(0), width(0), height(0) {}
+
+    // neighbours are the closest leds within neighbourRadius mm
+    DeviceGeometry(const std::vector<KeyRect>& keys, float neighbourRadius = 2.0f * KEY_UNIT_MM) {
+        ledCount = keys.size();
+
+        std::vector<float> centreX(ledCount);
+        std::vector<float> centreY(ledCount);
+
+        width = 0;
+        height = 0;
+        for(size_t led = 0; led < ledCount; led++) {
+            centreX[led] = (keys[led].x + keys[led].w / 2.0f) * KEY_UNIT_MM;
+            centreY[led] = (keys[led].y + keys[led].h / 2.0f) * KEY_UNIT_MM;
+
+            width = std::max(width, (keys[led].x + keys[led].w) * KEY_UNIT_MM);
+            height = std::max(height, (keys[led].y + keys[led].h) * KEY_UNIT_MM);
+        }
+
+        x = std::vector<uint16_t>(ledCount);
+        y = std::vector<uint16_t>(ledCount);
+        w = std::vector<uint16_t>(ledCount);
+        h = std::vector<uint16_t>(ledCount);
+        centreDistances = std::vector<uint16_t>(ledCount);
+        centreAngles = std::vector<uint16_t>(ledCount);
+
+        for(size_t led = 0; led < ledCount; led++) {
+            x[led] = toDistance(centreX[led]);
+            y[led] = toDistance(centreY[led]);
+            w[led] = toDistance(keys[led].w * KEY_UNIT_MM);
+            h[led] = toDistance(keys[led].h * KEY_UNIT_MM);
+
+            float dx = centreX[led] - width / 2.0f;
+            float dy = centreY[led] - height / 2.0f;
+
+            centreDistances[led] = toDistance(hypotf(dx, dy));
+            centreAngles[led] = toAngle(dx, dy);
+        }
+
+        distances = std::vector<uint16_t>(ledCount * ledCount);
+        angles = std::vector<uint16_t>(ledCount * ledCount);
+        neighbours = std::vector<uint8_t>(ledCount * MAX_NEIGHBOURS, NO_NEIGHBOUR);
+
+        std::vector<uint8_t> order(ledCount);
+        for(size_t from = 0; from < ledCount; from++) {
+            for(size_t to = 0; to < ledCount; to++) {
+                float dx = centreX[to] - centreX[from];
+                float dy = centreY[to] - centreY[from];
+
+                distances[from * ledCount + to] = toDistance(hypotf(dx, dy));
+                angles[from * ledCount + to] = toAngle(dx, dy);
+
+                order[to] = (uint8_t)to;
+            }
+
+            const uint16_t* row = &distances[from * ledCount];
+            std::sort(order.begin(), order.end(), [row](uint8_t a, uint8_t b) -> bool {
+                return row[a] < row[b];
+            });
+
+            size_t found = 0;
+            for(size_t i = 0; i < ledCount && found < MAX_NEIGHBOURS; i++) {
+                if(order[i] == from) continue;
+                if(row[order[i]] > toDistance(neighbourRadius)) break;
+
+                neighbours[from * MAX_NEIGHBOURS + found++] = order[i];
+            }
+        }
+    }
+
+    size_t getLEDCount() const { return ledCount; }
+    bool empty() const { return ledCount == 0; }
+
+    float getWidth() const { return width; }
+    float getHeight() const { return height; }
+
+    float getX(size_t led) const { return x[led] / GEOMETRY_SCALE; }
+    float getY(size_t led) const { return y[led] / GEOMETRY_SCALE; }
+    float getW(size_t led) const { return w[led] / GEOMETRY_SCALE; }
+    float getH(size_t led) const { return h[led] / GEOMETRY_SCALE; }
+
+    float getDistance(size_t from, size_t to) const { return distances[from * ledCount + to] / GEOMETRY_SCALE; }
+    float getCentreDistance(size_t led) const { return centreDistances[led] / GEOMETRY_SCALE; }
+
+    // raw tables for per frame loops
+    const uint16_t* xTable() const { return x.data(); }
+    const uint16_t* yTable() const { return y.data(); }
+
+    // distances/angles from one led to every led
+    const uint16_t* distanceRow(size_t from) const { return &distances[from * ledCount]; }
+    const uint16_t* angleRow(size_t from) const { return &angles[from * ledCount]; }
+
+    const uint16_t* centreDistanceTable() const { return centreDistances.data(); }
+    const uint16_t* centreAngleTable() const { return centreAngles.data(); }
+
+    const uint8_t* neighbourRow(size_t led) const { return &neighbours[led * MAX_NEIGHBOURS]; }
+};
+
+#endif
@@ -11,7 +11,8 @@ public:
     Keyboard(unsigned int VENDOR_ID, unsigned int PRODUCT_ID, unsigned int usage_page, unsigned int usage, std::vector<std::vector<uint8_t>> leds, std::function<void()> onDeviceConnect) :
         Device(VENDOR_ID, PRODUCT_ID, usage_page, usage, leds, onDeviceConnect) {}
 
-    virtual void draw_frame() = 0;
+    // false if no frame was sent
+    virtual bool draw_frame() = 0;
 };
 
 #endif
@@ -11,8 +11,6 @@ public:
         Device(vendor_id, product_id, usage_page, usage, leds, onDeviceConnect) {
         
     }
-
-    virtual void set_led(uint8_t led, RGB rgb) = 0;
 };
 
 #endif
\ No newline at end of file
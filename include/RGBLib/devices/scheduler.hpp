@@ -0,0 +1,282 @@
+#ifndef __RGBLIB_SCHEDULER_HPP__
+#define __RGBLIB_SCHEDULER_HPP__
+
+#include "device.hpp"
+#include "timeline.hpp"
+#include "../util/activity.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+// per device counters, written by the device's thread only
+struct ScheduledDeviceStats {
+    std::atomic<size_t> frames;
+    // deadlines that had already passed when the frame was done
+    std::atomic<size_t> missed;
+    // microseconds
+    std::atomic<uint32_t> lastFrame;
+    std::atomic<uint32_t> maxFrame;
+};
+
+// drives every registered device from its own thread at its own rate.
+// all of them render against the same timeline, seconds since the scheduler was made,
+// and a device that blocks on slow transfers only delays its own frames.
+// devices are given the time their frame will show rather than when it started, see Timeline.
+// a device that is gone is only checked on every so often, and with a governor nothing renders while it is idle
+class RenderScheduler {
+private:
+    struct Entry {
+        std::string name;
+        Device* device;
+        // can be changed while running, see set_fps
+        std::atomic<double> fps;
+
+        // renders and sends one frame for the time given, true if the device was sent it
+        std::function<bool(double)> render;
+
+        // index in the timeline, devices only
+        size_t timing;
+
+        // the device was gone when last checked
+        std::atomic<bool> absent;
+        // the last frame was drawn idle, so the device is dark
+        bool dark;
+
+        ScheduledDeviceStats stats;
+        std::thread thread;
+    };
+
+    Timeline timeline;
+    std::vector<std::unique_ptr<Entry>> entries;
+
+    std::atomic<bool> running;
+
+    // wakes threads pausing for a gone device when stopping
+    std::mutex pauseMutex;
+    std::condition_variable pauseCondition;
+
+    ActivityGovernor* governor;
+    std::mutex presenceMutex;
+
+    // how often a gone device is checked for
+    static constexpr std::chrono::seconds ABSENT_CHECK = std::chrono::seconds(1);
+
+    // sleeps unless stopped first
+    void pause(std::chrono::steady_clock::duration duration) {
+        std::unique_lock<std::mutex> lock(pauseMutex);
+        pauseCondition.wait_for(lock, duration, [this]() -> bool { return !running; });
+    }
+
+    // the governor idles once every device is gone
+    void setAbsent(Entry* entry, bool absent) {
+        if(entry->absent.exchange(absent) == absent || !governor) return;
+
+        std::lock_guard<std::mutex> lock(presenceMutex);
+
+        bool present = false;
+        for(std::unique_ptr<Entry>& other : entries) {
+            if(other->device && !other->absent) present = true;
+        }
+
+        governor->set_present(present);
+    }
+
+    // true if the entry waited for input instead of rendering.
+    // the first idle frame is still drawn, so the device is left dark rather than on its last colours
+    bool idle(Entry* entry) {
+        if(governor->state() != ACTIVITY_IDLE) {
+            entry->dark = false;
+            return false;
+        }
+
+        if(!entry->dark) {
+            entry->dark = true;
+            return false;
+        }
+
+        governor->wait_active([this]() -> bool { return !running; });
+        entry->dark = false;
+
+        return true;
+    }
+
+    void run(Entry* entry) {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+
+        while(running) {
+            // a disconnected device has nothing to send to
+            if(entry->device && !entry->device->is_connected()) {
+                setAbsent(entry, true);
+
+                pause(ABSENT_CHECK);
+                deadline = std::chrono::steady_clock::now();
+
+                continue;
+            }
+
+            if(entry->device) setAbsent(entry, false);
+
+            if(governor && idle(entry)) {
+                deadline = std::chrono::steady_clock::now();
+                continue;
+            }
+
+            double fps = governor ? governor->limit_fps(entry->fps) : entry->fps.load();
+            std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            double startTime = timeline.now();
+
+            if(!entry->device) {
+                entry->render(startTime);
+            }
+            else {
+                double intended = timeline.displayTime(entry->timing, startTime);
+
+                // the device draws once its last report is in. only frames the renderer says went out count,
+                // the report counter also moves for probes
+                if(entry->render(intended)) {
+                    timeline.record(entry->timing, intended, startTime, timeline.now());
+                }
+            }
+
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            uint32_t took = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+            entry->stats.frames++;
+            entry->stats.lastFrame = took;
+            if(took > entry->stats.maxFrame) entry->stats.maxFrame = took;
+
+            // a late frame skips the deadlines it missed instead of rushing to catch up
+            deadline += period;
+            if(end > deadline) {
+                entry->stats.missed++;
+                deadline = end;
+            }
+
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+
+public:
+    RenderScheduler() {
+        running = false;
+        governor = nullptr;
+    }
+
+    ~RenderScheduler() {
+        stop();
+    }
+
+    // devices have to be added before start, the scheduler does not own them.
+    // work that is not tied to a device, like drawing a shared canvas, is added without one.
+    // render returns whether the device was sent a frame, which is all the latency is sampled from
+    void add(const char* name, Device* device, double fps, std::function<bool(double)> render) {
+        if(running) return;
+
+        std::unique_ptr<Entry> entry = std::make_unique<Entry>();
+        entry->name = name;
+        entry->device = device;
+        entry->fps = fps;
+        entry->render = render;
+        entry->timing = device ? timeline.add() : 0;
+        entry->absent = false;
+        entry->dark = false;
+
+        entry->stats.frames = 0;
+        entry->stats.missed = 0;
+        entry->stats.lastFrame = 0;
+        entry->stats.maxFrame = 0;
+
+        entries.push_back(std::move(entry));
+    }
+
+    void start() {
+        if(running) return;
+        running = true;
+
+        for(std::unique_ptr<Entry>& entry : entries) {
+            entry->dark = false;
+            entry->thread = std::thread(&RenderScheduler::run, this, entry.get());
+        }
+    }
+
+    // lets entries wait out idle instead of rendering it and caps their fps on battery, set before start
+    void set_governor(ActivityGovernor* governor) {
+        if(running) return;
+        this->governor = governor;
+    }
+
+    void stop() {
+        if(!running) return;
+
+        {
+            std::lock_guard<std::mutex> lock(pauseMutex);
+            running = false;
+        }
+
+        pauseCondition.notify_all();
+        if(governor) governor->wake();
+
+        for(std::unique_ptr<Entry>& entry : entries) {
+            entry->thread.join();
+        }
+    }
+
+    // changes the rate of the entry added as name from its next frame, false if there is none
+    bool set_fps(const std::string& name, double fps) {
+        if(fps <= 0) return false;
+
+        for(std::unique_ptr<Entry>& entry : entries) {
+            if(entry->name != name) continue;
+
+            entry->fps = fps;
+            return true;
+        }
+
+        return false;
+    }
+
+    // the shared timeline, seconds
+    double now() {
+        return timeline.now();
+    }
+
+    // a time on the shared timeline as a clock time
+    std::chrono::steady_clock::time_point at(double time) {
+        return timeline.at(time);
+    }
+
+    void printStats() {
+        for(std::unique_ptr<Entry>& entry : entries) {
+            printf(
+                "%s: %zu frames at %.1f fps, %zu missed, last %uus, max %uus\n",
+                entry->name.c_str(), entry->stats.frames.load(), entry->fps.load(), entry->stats.missed.load(),
+                entry->stats.lastFrame.load(), entry->stats.maxFrame.load()
+            );
+
+            if(!entry->device) continue;
+
+            TimelineDeviceStats timing = timeline.getStats(entry->timing);
+            printf(
+                "%s: latency %.1fms, shown %+.1fms from intended, last %+.1fms\n",
+                entry->name.c_str(), timing.latency * 1000, timing.error * 1000, timing.lastError * 1000
+            );
+        }
+
+        printf("skew between devices %.1fms\n", timeline.getSkew() * 1000);
+    }
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef __RGBLIB_TIMELINE_HPP__
+#define __RGBLIB_TIMELINE_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+// how far one device's frames are from where the timeline wanted them, seconds
+struct TimelineDeviceStats {
+    // from a frame starting to render to its last report being written
+    double latency;
+
+    // shown minus intended, averaged and of the last frame that sent anything
+    double error;
+    double lastError;
+
+    size_t samples;
+};
+
+// one monotonic clock every device renders against, seconds since the timeline was made.
+// each frame is rendered for the time it is expected to show, its start plus the device's measured latency,
+// so devices with slow transfers draw further ahead and show the same phase as the fast ones
+class Timeline {
+private:
+    struct DeviceTiming {
+        std::atomic<double> latency;
+        std::atomic<double> error;
+        std::atomic<double> lastError;
+        std::atomic<size_t> samples;
+    };
+
+    std::chrono::steady_clock::time_point epoch;
+    std::vector<std::unique_ptr<DeviceTiming>> devices;
+
+    // weight of the newest frame in the averages
+    double weight;
+
+public:
+    Timeline(double weight = 0.1) : weight(weight) {
+        this->epoch = std::chrono::steady_clock::now();
+    }
+
+    // devices have to be added before any thread uses the timeline, returns the device's index
+    size_t add() {
+        std::unique_ptr<DeviceTiming> timing = std::make_unique<DeviceTiming>();
+        timing->latency = 0;
+        timing->error = 0;
+        timing->lastError = 0;
+        timing->samples = 0;
+
+        devices.push_back(std::move(timing));
+        return devices.size() - 1;
+    }
+
+    double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    std::chrono::steady_clock::time_point at(double time) {
+        return epoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(time));
+    }
+
+    // when a frame that starts rendering at start will show on device
+    double displayTime(size_t device, double start) {
+        return start + devices[device]->latency;
+    }
+
+    // a frame rendered for intended started at start and had its last report written at shown.
+    // only frames that wrote something say anything about the device's latency
+    void record(size_t device, double intended, double start, double shown) {
+        DeviceTiming& timing = *devices[device];
+
+        double error = shown - intended;
+        if(timing.samples == 0) {
+            timing.latency = shown - start;
+            timing.error = error;
+        }
+        else {
+            timing.latency = timing.latency + (shown - start - timing.latency) * weight;
+            timing.error = timing.error + (error - timing.error) * weight;
+        }
+
+        timing.lastError = error;
+        timing.samples++;
+    }
+
+    TimelineDeviceStats getStats(size_t device) {
+        DeviceTiming& timing = *devices[device];
+        return { timing.latency, timing.error, timing.lastError, timing.samples };
+    }
+
+    // largest difference between two devices in how late they show the same phase
+    double getSkew() {
+        double lowest = 0;
+        double highest = 0;
+        bool any = false;
+
+        for(std::unique_ptr<DeviceTiming>& timing : devices) {
+            if(timing->samples == 0) continue;
+
+            double error = timing->error;
+            lowest = any ? std::min(lowest, error) : error;
+            highest = any ? std::max(highest, error) : error;
+            any = true;
+        }
+
+        return highest - lowest;
+    }
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef __RGBLIB_ACTIVITY_HPP__
+#define __RGBLIB_ACTIVITY_HPP__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <dirent.h>
+
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+enum ActivityState {
+    ACTIVITY_ACTIVE = 0,
+    // no input for the idle time, dimming to black over the fade time
+    ACTIVITY_FADING,
+    // dark, or no device left to draw on. nothing needs rendering until the next input
+    ACTIVITY_IDLE
+};
+
+// decides when rendering is worth doing. input from any device keeps it active,
+// after idleSeconds without any it fades out and idles until the next input.
+// threads with nothing to do while idle block in wait_active instead of polling, and input wakes them straight away
+class ActivityGovernor {
+private:
+    // nanoseconds on the steady clock
+    std::atomic<int64_t> lastInput;
+
+    // 0 never idles
+    std::atomic<double> idleSeconds;
+    std::atomic<double> fadeSeconds;
+    // the fps cap while on battery, 0 for none
+    std::atomic<double> batteryFps;
+
+    // cleared once every device is gone
+    std::atomic<bool> present;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    // threads in wait_active, input only takes the mutex when there are any
+    std::atomic<size_t> sleepers;
+
+    // the power supplies are read again once this passes, see refresh_battery
+    int64_t nextPowerCheck;
+    std::atomic<bool> battery;
+
+    static constexpr int64_t POWER_CHECK_NS = 10 * 1000000000LL;
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static std::string readLine(const std::string& path) {
+        std::ifstream stream(path);
+        std::string line;
+        std::getline(stream, line);
+
+        return line;
+    }
+
+    // whether a battery in /sys/class/power_supply is discharging, nothing there is mains
+    static bool readBattery() {
+        const std::string root = "/sys/class/power_supply/";
+
+        DIR* directory = opendir(root.c_str());
+        if(!directory) return false;
+
+        bool discharging = false;
+        while(struct dirent* entry = readdir(directory)) {
+            if(entry->d_name[0] == '.') continue;
+
+            std::string supply = root + entry->d_name;
+            if(readLine(supply + "/type") != "Battery") continue;
+
+            if(readLine(supply + "/status") == "Discharging") {
+                discharging = true;
+                break;
+            }
+        }
+
+        closedir(directory);
+        return discharging;
+    }
+
+    // taking the mutex orders this with a waiter between checking its predicate and sleeping
+    void notify() {
+        std::lock_guard<std::mutex> lock(mutex);
+        condition.notify_all();
+    }
+
+    // seconds since the last input
+    double away() {
+        return std::max<int64_t>(now() - lastInput, 0) / 1e9;
+    }
+
+public:
+    ActivityGovernor(double idleSeconds, double fadeSeconds, double batteryFps) {
+        lastInput = now();
+
+        this->idleSeconds = idleSeconds;
+        this->fadeSeconds = fadeSeconds;
+        this->batteryFps = batteryFps;
+
+        present = true;
+        sleepers = 0;
+
+        nextPowerCheck = 0;
+        battery = false;
+    }
+
+    // from any thread, cheap enough for every input event
+    void input() {
+        lastInput = now();
+
+        if(sleepers > 0) notify();
+    }
+
+    // a device coming back counts as input, so it does not come back dark
+    void set_present(bool present) {
+        if(!present) {
+            this->present = false;
+            return;
+        }
+
+        if(!this->present.exchange(true)) input();
+    }
+
+    // 0 never idles, takes effect straight away
+    void set_idle(double seconds) {
+        idleSeconds = seconds;
+        notify();
+    }
+
+    double get_idle() { return idleSeconds; }
+
+    ActivityState state() {
+        if(!present) return ACTIVITY_IDLE;
+
+        double idle = idleSeconds;
+        if(idle <= 0) return ACTIVITY_ACTIVE;
+
+        double since = away();
+        if(since < idle) return ACTIVITY_ACTIVE;
+
+        return since < idle + fadeSeconds ? ACTIVITY_FADING : ACTIVITY_IDLE;
+    }
+
+    // 1 while active down to 0 once idle
+    float brightness() {
+        switch(state()) {
+        case ACTIVITY_ACTIVE: return 1.0f;
+        case ACTIVITY_IDLE: return 0.0f;
+        default: break;
+        }
+
+        return std::clamp(1.0f - (float)((away() - idleSeconds) / fadeSeconds), 0.0f, 1.0f);
+    }
+
+    // blocks while idle, until input or stopping returns true. stopping is checked again after wake
+    void wait_active(std::function<bool()> stopping) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        sleepers++;
+        condition.wait(lock, [this, &stopping]() -> bool { return state() != ACTIVITY_IDLE || stopping(); });
+        sleepers--;
+    }
+
+    // for a thread that set its own stop flag and may be in wait_active
+    void wake() {
+        notify();
+    }
+
+    // reads the power supplies if it has been a few seconds, from one thread that is not drawing anything.
+    // sysfs reads of a battery can wait on the embedded controller for a long time
+    void refresh_battery() {
+        int64_t time = now();
+        if(time < nextPowerCheck) return;
+
+        nextPowerCheck = time + POWER_CHECK_NS;
+        battery = readBattery();
+    }
+
+    // as of the last refresh_battery
+    bool on_battery() {
+        return battery;
+    }
+
+    // fps, capped while on battery. never reads the power supplies itself
+    double limit_fps(double fps) {
+        double cap = batteryFps;
+        if(cap <= 0 || !on_battery()) return fps;
+
+        return std::min(fps, cap);
+    }
+
+    void printStats() {
+        static const char* STATES[] = { "active", "fading", "idle" };
+
+        printf(
+            "activity: %s, last input %.1fs ago, idle after %.0fs, %s\n",
+            STATES[state()], away(), idleSeconds.load(), on_battery() ? "on battery" : "on mains"
+        );
+    }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef __RGBLIB_COMPOSITOR_HPP__
+#define __RGBLIB_COMPOSITOR_HPP__
+
+#include "rgb.hpp"
+#include "frame.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+#include <algorithm>
+
+enum BlendMode {
+    BLEND_REPLACE = 0,
+    BLEND_ADD,
+    BLEND_MULTIPLY,
+    BLEND_SCREEN
+};
+
+// the frame's mask is the layer's mask, unset entries are transparent
+template<size_t N>
+struct BasicLayer {
+    BasicFrame<N> frame;
+
+    BlendMode mode;
+    uint8_t opacity;
+
+    bool visible() const {
+        return opacity > 0 && frame.mask.any();
+    }
+};
+
+// ordered stack of layers of N leds blended bottom to top onto black
+template<size_t N>
+class BasicCompositor {
+private:
+    std::vector<BasicLayer<N>> layers;
+
+    // mask and opacity of the layer being blended, per colour byte out of 256
+    uint16_t weights[N * 3];
+
+    // the blend, opacity and mask in one branch free loop per layer
+    template<BlendMode mode>
+    static void blend(uint8_t* dst, const uint8_t* src, const uint16_t* weights) {
+        for(size_t i = 0; i < N * 3; i++) {
+            uint16_t d = dst[i];
+            uint16_t s = src[i];
+            uint16_t b;
+
+            switch(mode) {
+            case BLEND_ADD: b = std::min<uint16_t>(d + s, 255); break;
+            case BLEND_MULTIPLY: b = (d * s + 255) >> 8; break;
+            case BLEND_SCREEN: b = 255 - (((255 - d) * (255 - s) + 255) >> 8); break;
+            default: b = s; break;
+            }
+
+            dst[i] = (b * weights[i] + d * (256 - weights[i])) >> 8;
+        }
+    }
+
+public:
+    // layers are drawn in the order they are added, returns the layer's index
+    size_t add_layer(BlendMode mode, uint8_t opacity = 0xFF) {
+        layers.push_back({ BasicFrame<N>(), mode, opacity });
+        return layers.size() - 1;
+    }
+
+    BasicLayer<N>& get_layer(size_t index) { return layers[index]; }
+    size_t getLayerCount() { return layers.size(); }
+    size_t getSize() { return N; }
+
+    // out gets every led any visible layer covers
+    void composite(BasicFrame<N>& out) {
+        out.clear();
+
+        for(BasicLayer<N>& layer : layers) {
+            if(!layer.visible()) continue;
+
+            uint16_t weight = layer.opacity + (layer.opacity >> 7);
+            for(size_t led = 0; led < N; led++) {
+                uint16_t ledWeight = layer.frame.mask.test(led) ? weight : 0;
+
+                weights[led * 3] = ledWeight;
+                weights[led * 3 + 1] = ledWeight;
+                weights[led * 3 + 2] = ledWeight;
+            }
+
+            uint8_t* dst = reinterpret_cast<uint8_t*>(out.colors);
+            const uint8_t* src = reinterpret_cast<const uint8_t*>(layer.frame.colors);
+
+            switch(layer.mode) {
+            case BLEND_ADD: blend<BLEND_ADD>(dst, src, weights); break;
+            case BLEND_MULTIPLY: blend<BLEND_MULTIPLY>(dst, src, weights); break;
+            case BLEND_SCREEN: blend<BLEND_SCREEN>(dst, src, weights); break;
+            default: blend<BLEND_REPLACE>(dst, src, weights); break;
+            }
+
+            out.mask |= layer.frame.mask;
+        }
+    }
+};
+
+typedef BasicLayer<Frame::SIZE> Layer;
+typedef BasicCompositor<Frame::SIZE> Compositor;
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef __RGBLIB_CONTROL_HPP__
+#define __RGBLIB_CONTROL_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+
+// the control socket's protocol, one batch per line:
+//
+//     command arg arg; command arg; ...\n
+//
+// the commands of a batch are checked as soon as the line is in and applied together at the next frame boundary.
+// every line is answered with "ok" or "error <reason>" in order, so a client can pipeline lines without waiting
+
+// $XDG_RUNTIME_DIR/waveeffect.sock, /tmp/waveeffect.sock without one
+inline std::string controlSocketPath() {
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    return std::string(runtime && *runtime ? runtime : "/tmp") + "/waveeffect.sock";
+}
+
+// splits a batch line into commands and each command into its words
+inline std::vector<std::vector<std::string>> controlSplit(const std::string& line) {
+    std::vector<std::vector<std::string>> commands(1);
+
+    std::string word;
+    for(size_t i = 0; i <= line.size(); i++) {
+        char c = i < line.size() ? line[i] : ';';
+
+        if(c != ';' && c != ' ' && c != '\t' && c != '\r') {
+            word += c;
+            continue;
+        }
+
+        if(!word.empty()) commands.back().push_back(word);
+        word.clear();
+
+        if(c == ';' && !commands.back().empty()) commands.emplace_back();
+    }
+
+    if(commands.back().empty()) commands.pop_back();
+    return commands;
+}
+
+// listens on a unix socket and turns every line into a batch of Commands.
+// lines are parsed on the server's own thread, the renderer only ever swaps out the queue,
+// and while the queue is full clients are simply not read from until it has room
+template<typename Command>
+class ControlServer {
+public:
+    typedef std::vector<Command> Batch;
+    // words of one command into out, false with error set if it is not a valid one
+    typedef std::function<bool(const std::vector<std::string>&, Command&, std::string&)> Parser;
+
+    static constexpr size_t MAX_CLIENTS = 16;
+    static constexpr size_t MAX_LINE = 64 * 1024;
+    // batches waiting for a frame
+    static constexpr size_t MAX_QUEUED = 4096;
+
+private:
+    struct Client {
+        int fd;
+        std::string in;
+        std::string out;
+
+        // it will not send anything more, it is closed once every line it sent is answered
+        bool eof;
+    };
+
+    Parser parser;
+    // called on the server's thread after every batch queued, may be empty
+    std::function<void()> queued;
+    std::string path;
+
+    int listener;
+    // wakes the thread to stop
+    int wake;
+
+    std::thread thread;
+    std::vector<Client> clients;
+
+    std::mutex queueMutex;
+    std::vector<Batch> queue;
+
+    std::atomic<size_t> batches;
+    std::atomic<size_t> commands;
+    std::atomic<size_t> rejected;
+
+    // false without taking the line if the queue is full
+    bool handle(Client& client, const std::string& line) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if(queue.size() >= MAX_QUEUED) return false;
+        }
+
+        std::vector<std::vector<std::string>> words = controlSplit(line);
+        if(words.empty()) return true;
+
+        Batch batch(words.size());
+        std::string error;
+
+        for(size_t i = 0; i < words.size(); i++) {
+            if(parser(words[i], batch[i], error)) continue;
+
+            rejected++;
+            client.out += "error " + words[i][0].substr(0, 32) + ": " + error + "\n";
+
+            return true;
+        }
+
+        {
+            // only this thread adds to the queue, so it still has room
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.push_back(std::move(batch));
+        }
+
+        batches++;
+        commands += words.size();
+
+        if(queued) queued();
+
+        client.out += "ok\n";
+        return true;
+    }
+
+    // handles the complete lines that came in, false if some have to wait for room in the queue
+    bool process(Client& client) {
+        size_t start = 0;
+        bool room = true;
+
+        for(size_t end = client.in.find('\n'); end != std::string::npos; end = client.in.find('\n', start)) {
+            room = handle(client, client.in.substr(start, end - start));
+            if(!room) break;
+
+            start = end + 1;
+        }
+
+        client.in.erase(0, start);
+        return room;
+    }
+
+    // reads until the client has nothing more, its lines wait for the queue or it has too many replies waiting.
+    // false once it is gone or broke the protocol
+    bool receive(Client& client) {
+        char buffer[16 * 1024];
+
+        while(true) {
+            if(!process(client) || client.eof || client.out.size() > MAX_LINE) return true;
+
+            if(client.in.size() > MAX_LINE) {
+                client.out += "error line too long\n";
+                return false;
+            }
+
+            ssize_t got = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if(got == 0) {
+                client.eof = true;
+                return true;
+            }
+
+            if(got < 0) {
+                if(errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+
+            client.in.append(buffer, got);
+        }
+    }
+
+    // false once the client is gone
+    bool flush(Client& client) {
+        while(!client.out.empty()) {
+            ssize_t sent = send(client.fd, client.out.data(), client.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            if(sent < 0) {
+                if(errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+
+            client.out.erase(0, sent);
+        }
+
+        return true;
+    }
+
+    void accept_clients() {
+        while(true) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd == -1) return;
+
+            if(clients.size() >= MAX_CLIENTS) {
+                const char* busy = "error too many clients\n";
+                send(fd, busy, strlen(busy), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+                ::close(fd);
+                continue;
+            }
+
+            clients.push_back({ fd, std::string(), std::string(), false });
+        }
+    }
+
+    void run() {
+        std::vector<struct pollfd> fds;
+
+        while(true) {
+            fds.clear();
+            fds.push_back({ wake, POLLIN, 0 });
+            fds.push_back({ listener, POLLIN, 0 });
+
+            // lines waiting for room are retried every few milliseconds, otherwise only the sockets wake the thread
+            bool waiting = false;
+            for(Client& client : clients) {
+                bool held = client.in.find('\n') != std::string::npos;
+                waiting = waiting || held;
+
+                // a client that does not read its replies is not read from either
+                short events = client.eof || held || client.out.size() > MAX_LINE ? 0 : POLLIN;
+                if(!client.out.empty()) events |= POLLOUT;
+
+                // poll ignores negative fds, a hung up client would wake it over and over
+                fds.push_back({ client.eof && client.out.empty() ? -1 : client.fd, events, 0 });
+            }
+
+            if(poll(fds.data(), fds.size(), waiting ? 4 : -1) < 0) {
+                if(errno == EINTR) continue;
+
+                printf("Control socket poll failed: %s\n", strerror(errno));
+                return;
+            }
+
+            if(fds[0].revents) return;
+
+            // clients and fds line up until the accepted ones at the end
+            size_t polled = clients.size();
+            for(size_t i = 0; i < polled; i++) {
+                Client& client = clients[i];
+
+                bool alive = receive(client) && flush(client) && !(fds[i + 2].revents & (POLLERR | POLLNVAL));
+                if(client.eof && client.in.find('\n') == std::string::npos) alive = false;
+
+                if(!alive) {
+                    // a client that is done sending still gets the replies to its last lines
+                    flush(client);
+
+                    ::close(client.fd);
+                    client.fd = -1;
+                }
+            }
+
+            std::vector<Client> open;
+            for(Client& client : clients) {
+                if(client.fd != -1) open.push_back(std::move(client));
+            }
+
+            clients = std::move(open);
+
+            if(fds[1].revents & POLLIN) accept_clients();
+        }
+    }
+
+public:
+    ControlServer(Parser parser, std::function<void()> queued = nullptr) : parser(parser), queued(queued), listener(-1), wake(-1) {
+        batches = 0;
+        commands = 0;
+        rejected = 0;
+    }
+
+    ~ControlServer() {
+        stop();
+    }
+
+    // replaces a socket left behind at path, false if it could not listen
+    bool start(const std::string& path) {
+        if(listener != -1) return true;
+
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+
+        if(path.size() >= sizeof(address.sun_path)) {
+            printf("Control socket path %s is too long\n", path.c_str());
+            return false;
+        }
+
+        strcpy(address.sun_path, path.c_str());
+
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        wake = eventfd(0, EFD_CLOEXEC);
+
+        unlink(path.c_str());
+        if(listener == -1 || wake == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listener, (int)MAX_CLIENTS) == -1) {
+            printf("Failed to listen on control socket %s: %s\n", path.c_str(), strerror(errno));
+
+            if(listener != -1) ::close(listener);
+            if(wake != -1) ::close(wake);
+
+            listener = -1;
+            wake = -1;
+
+            return false;
+        }
+
+        this->path = path;
+        thread = std::thread(&ControlServer::run, this);
+
+        printf("Listening for control commands on %s\n", path.c_str());
+
+        return true;
+    }
+
+    void stop() {
+        if(listener == -1) return;
+
+        uint64_t one = 1;
+        if(write(wake, &one, sizeof(one)) != sizeof(one)) {
+            printf("Failed to wake the control socket thread: %s\n", strerror(errno));
+        }
+
+        thread.join();
+
+        for(Client& client : clients) {
+            ::close(client.fd);
+        }
+
+        clients.clear();
+
+        ::close(listener);
+        ::close(wake);
+        unlink(path.c_str());
+
+        listener = -1;
+        wake = -1;
+    }
+
+    // appends every batch received since the last take to out, oldest first.
+    // never waits, if the server thread is queueing a batch right now it is picked up next time
+    bool take(std::vector<Batch>& out) {
+        std::unique_lock<std::mutex> lock(queueMutex, std::try_to_lock);
+        if(!lock.owns_lock() || queue.empty()) return false;
+
+        if(out.empty()) {
+            out.swap(queue);
+        }
+        else {
+            for(Batch& batch : queue) {
+                out.push_back(std::move(batch));
+            }
+
+            queue.clear();
+        }
+
+        return true;
+    }
+
+    size_t get_batches() { return batches; }
+    size_t get_commands() { return commands; }
+    // lines answered with an error
+    size_t get_rejected() { return rejected; }
+};
+
+#endif
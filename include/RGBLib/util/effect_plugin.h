@@ -0,0 +1,57 @@
+#ifndef __RGBLIB_EFFECT_PLUGIN_H__
+#define __RGBLIB_EFFECT_PLUGIN_H__
+
+/*
+ * the c abi between the daemon and effect plugins, the only header a plugin needs.
+ * a plugin is a shared library exporting
+ *
+ *     const WaveEffectPlugin* waveeffect_plugin(void);
+ *
+ * dropped into the plugin directory it is loaded straight away, and loaded again whenever the file changes.
+ * render is only ever called from one thread, create and destroy from another, never at the same time for a state
+ */
+
+#include <stdint.h>
+
+#define WAVEEFFECT_PLUGIN_ABI 1
+
+/* laid out like the daemon's RGB */
+typedef struct WaveEffectRGB {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} WaveEffectRGB;
+
+typedef struct WaveEffectInput {
+    /* seconds on the daemon's timeline when the frame will show */
+    double time;
+
+    uint32_t ledCount;
+    /* led centres in mm from the device's top left, and its size */
+    const float* x;
+    const float* y;
+    float width;
+    float height;
+
+    /* set with "param index value" on the control socket, 0 until then */
+    const float* params;
+    uint32_t paramCount;
+} WaveEffectInput;
+
+typedef struct WaveEffectPlugin {
+    /* WAVEEFFECT_PLUGIN_ABI as the plugin was built */
+    uint32_t abi;
+
+    /* the state render is given, may be null. null from create fails the load */
+    void* (*create)(uint32_t ledCount);
+    void (*destroy)(void* state);
+
+    /* every led of out, ledCount long */
+    void (*render)(void* state, const WaveEffectInput* input, WaveEffectRGB* out);
+} WaveEffectPlugin;
+
+typedef const WaveEffectPlugin* (*WaveEffectPluginEntry)(void);
+
+#define WAVEEFFECT_PLUGIN_ENTRY "waveeffect_plugin"
+
+#endif
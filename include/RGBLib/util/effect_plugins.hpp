@@ -0,0 +1,421 @@
+#ifndef __RGBLIB_EFFECT_PLUGINS_HPP__
+#define __RGBLIB_EFFECT_PLUGINS_HPP__
+
+#include "rgb.hpp"
+#include "effect_plugin.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static_assert(sizeof(WaveEffectRGB) == sizeof(RGB), "plugins write straight into RGB frames");
+
+// $XDG_CONFIG_HOME/waveeffect/plugins, ~/.config/waveeffect/plugins without it
+inline std::string effectPluginDirectory() {
+    const char* config = getenv("XDG_CONFIG_HOME");
+    if(config && *config) return std::string(config) + "/waveeffect/plugins";
+
+    const char* home = getenv("HOME");
+    return std::string(home ? home : "") + "/.config/waveeffect/plugins";
+}
+
+// one loaded version of a plugin
+struct EffectPlugin {
+    // the file name without .so
+    std::string name;
+
+    void* library;
+    // the memfd the library was loaded from, kept open so no other version gets its /proc/self/fd path
+    int fd;
+    const WaveEffectPlugin* api;
+    void* state;
+
+    // render times, microseconds
+    size_t frames;
+    uint32_t lastFrame;
+    uint32_t maxFrame;
+    // frames over budget in a row, past the limit the plugin is left out until it is reloaded
+    size_t overBudget;
+    bool disabled;
+
+    ~EffectPlugin() {
+        if(api && api->destroy) api->destroy(state);
+        if(library) dlclose(library);
+        if(fd != -1) close(fd);
+    }
+};
+
+// loads every .so in a directory and reloads it whenever it changes, watched with inotify on a thread of its own.
+// a new version replaces the old one between frames when the render thread calls swap,
+// the old one is destroyed and unloaded back on the loader's thread so the renderer never waits on a plugin
+class EffectPluginHost {
+public:
+    // frames in a row over budget before a plugin is left out
+    static constexpr size_t OVER_BUDGET_LIMIT = 3;
+
+private:
+    // a plugin that was loaded or, without one, removed
+    struct Change {
+        std::string name;
+        std::unique_ptr<EffectPlugin> plugin;
+    };
+
+    std::string directory;
+    uint32_t ledCount;
+    std::vector<float> x;
+    std::vector<float> y;
+    float width;
+    float height;
+
+    std::chrono::microseconds budget;
+
+    int inotify;
+    // wakes the loader to unload retired plugins or stop
+    int wake;
+    std::atomic<bool> stopping;
+    // printed by the render thread, the only one that can look at the plugins
+    std::atomic<bool> printing;
+    std::thread thread;
+
+    std::mutex changeMutex;
+    std::vector<Change> changes;
+    std::vector<std::unique_ptr<EffectPlugin>> retired;
+
+    // only the render thread touches these
+    std::vector<std::unique_ptr<EffectPlugin>> plugins;
+    std::vector<Change> swapping;
+    std::vector<std::unique_ptr<EffectPlugin>> retiring;
+
+    static bool isPlugin(const char* file) {
+        size_t length = strlen(file);
+        return length > 3 && strcmp(file + length - 3, ".so") == 0 && file[0] != '.';
+    }
+
+    // dlopen hands back the library it already has for a path, so every version is loaded from a copy of its own.
+    // the copy is an anonymous memfd, nothing else can swap it and a noexec /tmp does not matter
+    std::unique_ptr<EffectPlugin> load(const std::string& file) {
+        std::string path = directory + "/" + file;
+
+        int out = memfd_create("waveeffect-plugin", MFD_CLOEXEC);
+        int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        bool copied = out != -1 && in != -1;
+        char buffer[64 * 1024];
+
+        ssize_t got;
+        while(copied && (got = read(in, buffer, sizeof(buffer))) != 0) {
+            copied = got > 0 && write(out, buffer, got) == got;
+        }
+
+        if(in != -1) close(in);
+
+        if(!copied) {
+            printf("Failed to copy effect plugin %s: %s\n", path.c_str(), strerror(errno));
+            if(out != -1) close(out);
+
+            return nullptr;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::unique_ptr<EffectPlugin> plugin = std::make_unique<EffectPlugin>();
+        plugin->name = file.substr(0, file.size() - 3);
+        plugin->library = dlopen(("/proc/self/fd/" + std::to_string(out)).c_str(), RTLD_NOW | RTLD_LOCAL);
+        plugin->fd = out;
+        plugin->api = nullptr;
+        plugin->state = nullptr;
+
+        if(!plugin->library) {
+            printf("Failed to load effect plugin %s: %s\n", path.c_str(), dlerror());
+            return nullptr;
+        }
+
+        WaveEffectPluginEntry entry = (WaveEffectPluginEntry)dlsym(plugin->library, WAVEEFFECT_PLUGIN_ENTRY);
+        const WaveEffectPlugin* api = entry ? entry() : nullptr;
+
+        if(!api || api->abi != WAVEEFFECT_PLUGIN_ABI || !api->render) {
+            printf("Effect plugin %s has no %s for abi %u\n", path.c_str(), WAVEEFFECT_PLUGIN_ENTRY, WAVEEFFECT_PLUGIN_ABI);
+            return nullptr;
+        }
+
+        if(api->create) {
+            plugin->state = api->create(ledCount);
+
+            if(!plugin->state) {
+                printf("Effect plugin %s failed to start\n", path.c_str());
+                return nullptr;
+            }
+        }
+
+        plugin->api = api;
+        plugin->frames = 0;
+        plugin->lastFrame = 0;
+        plugin->maxFrame = 0;
+        plugin->overBudget = 0;
+        plugin->disabled = false;
+
+        long long took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        printf("Loaded effect plugin %s in %lldus\n", plugin->name.c_str(), took);
+
+        return plugin;
+    }
+
+    // mkdir -p, false if path is still not a directory
+    static bool makeDirectories(const std::string& path) {
+        for(size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            mkdir(path.substr(0, slash).c_str(), 0755);
+        }
+
+        struct stat info;
+        return (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) && stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+    }
+
+    void queue(Change change) {
+        std::lock_guard<std::mutex> lock(changeMutex);
+        changes.push_back(std::move(change));
+    }
+
+    void scan() {
+        DIR* dir = opendir(directory.c_str());
+        if(!dir) return;
+
+        for(struct dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+            if(!isPlugin(entry->d_name)) continue;
+
+            std::unique_ptr<EffectPlugin> plugin = load(entry->d_name);
+            if(plugin) queue({ plugin->name, std::move(plugin) });
+        }
+
+        closedir(dir);
+    }
+
+    void run() {
+        scan();
+
+        alignas(struct inotify_event) char buffer[4096];
+        struct pollfd fds[2] = { { wake, POLLIN, 0 }, { inotify, POLLIN, 0 } };
+
+        while(!stopping) {
+            if(poll(fds, inotify == -1 ? 1 : 2, -1) < 0 && errno != EINTR) {
+                printf("Effect plugin watch failed: %s\n", strerror(errno));
+                return;
+            }
+
+            if(fds[0].revents & POLLIN) {
+                uint64_t count;
+                if(read(wake, &count, sizeof(count)) < 0) continue;
+
+                std::vector<std::unique_ptr<EffectPlugin>> unload;
+                {
+                    std::lock_guard<std::mutex> lock(changeMutex);
+                    unload.swap(retired);
+                }
+
+                // destroyed and closed here, out of the lock
+                unload.clear();
+            }
+
+            if(inotify == -1 || !(fds[1].revents & POLLIN)) continue;
+
+            ssize_t got = read(inotify, buffer, sizeof(buffer));
+            for(ssize_t offset = 0; offset < got;) {
+                const struct inotify_event* event = (const struct inotify_event*)(buffer + offset);
+                offset += sizeof(struct inotify_event) + event->len;
+
+                if(!event->len || !isPlugin(event->name)) continue;
+
+                std::string file = event->name;
+                std::string name = file.substr(0, file.size() - 3);
+
+                // a half written library is only loaded once it is closed or moved in whole
+                if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    std::unique_ptr<EffectPlugin> plugin = load(file);
+                    if(plugin) queue({ name, std::move(plugin) });
+                }
+                else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    printf("Effect plugin %s was removed\n", name.c_str());
+                    queue({ name, nullptr });
+                }
+            }
+        }
+    }
+
+    void printStats() {
+        for(std::unique_ptr<EffectPlugin>& plugin : plugins) {
+            printf(
+                "Effect plugin %s: %zu frames, last %uus, max %uus of %lldus%s\n",
+                plugin->name.c_str(), plugin->frames, plugin->lastFrame, plugin->maxFrame, (long long)budget.count(),
+                plugin->disabled ? ", left out for going over" : ""
+            );
+        }
+    }
+
+public:
+    // x and y are the led centres in mm, budget is what one frame of a plugin may take
+    EffectPluginHost(const float* x, const float* y, size_t ledCount, float width, float height, std::chrono::microseconds budget) :
+        ledCount((uint32_t)ledCount), x(x, x + ledCount), y(y, y + ledCount), width(width), height(height), budget(budget) {
+        inotify = -1;
+        wake = -1;
+        stopping = false;
+        printing = false;
+    }
+
+    ~EffectPluginHost() {
+        stop();
+    }
+
+    // loads what is in directory now and watches it, the directory is made if it does not exist yet
+    void start(const std::string& directory) {
+        if(wake != -1) return;
+
+        this->directory = directory;
+
+        if(!makeDirectories(directory)) {
+            printf("Failed to make effect plugin directory %s: %s\n", directory.c_str(), strerror(errno));
+        }
+
+        wake = eventfd(0, EFD_CLOEXEC);
+        inotify = inotify_init1(IN_CLOEXEC);
+
+        if(inotify != -1 && inotify_add_watch(inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) == -1) {
+            printf("Not watching %s for effect plugins: %s\n", directory.c_str(), strerror(errno));
+
+            close(inotify);
+            inotify = -1;
+        }
+
+        stopping = false;
+        thread = std::thread(&EffectPluginHost::run, this);
+    }
+
+    void stop() {
+        if(wake == -1) return;
+
+        stopping = true;
+
+        uint64_t one = 1;
+        if(write(wake, &one, sizeof(one)) != sizeof(one)) {
+            printf("Failed to wake the effect plugin watch: %s\n", strerror(errno));
+        }
+
+        thread.join();
+
+        if(inotify != -1) close(inotify);
+        close(wake);
+
+        inotify = -1;
+        wake = -1;
+    }
+
+    // the render thread, between frames: swaps in every plugin loaded since the last call.
+    // never waits, if the loader is queueing one right now it is picked up next frame
+    void swap() {
+        if(printing.exchange(false)) printStats();
+
+        {
+            std::unique_lock<std::mutex> lock(changeMutex, std::try_to_lock);
+            if(!lock.owns_lock()) return;
+
+            swapping.swap(changes);
+        }
+
+        for(Change& change : swapping) {
+            std::vector<std::unique_ptr<EffectPlugin>>::iterator old = std::find_if(plugins.begin(), plugins.end(), [&change](const std::unique_ptr<EffectPlugin>& plugin) -> bool {
+                return plugin->name == change.name;
+            });
+
+            if(old != plugins.end()) {
+                retiring.push_back(std::move(*old));
+
+                if(change.plugin) *old = std::move(change.plugin);
+                else plugins.erase(old);
+            }
+            else if(change.plugin) {
+                plugins.push_back(std::move(change.plugin));
+            }
+        }
+
+        swapping.clear();
+        if(retiring.empty()) return;
+
+        // the loader unloads them, if it is busy they go next swap whether anything changed or not
+        std::unique_lock<std::mutex> lock(changeMutex, std::try_to_lock);
+        if(!lock.owns_lock()) return;
+
+        for(std::unique_ptr<EffectPlugin>& plugin : retiring) {
+            retired.push_back(std::move(plugin));
+        }
+
+        retiring.clear();
+        lock.unlock();
+
+        uint64_t one = 1;
+        if(write(wake, &one, sizeof(one)) != sizeof(one)) {
+            printf("Failed to wake the effect plugin watch: %s\n", strerror(errno));
+        }
+    }
+
+    // the render thread: draws the plugin called name for the frame showing at time into out, ledCount long.
+    // false if there is no such plugin or it has gone over its budget, out is left as it was then
+    bool render(const std::string& name, double time, const float* params, size_t paramCount, RGB* out) {
+        for(std::unique_ptr<EffectPlugin>& plugin : plugins) {
+            if(plugin->name != name) continue;
+            if(plugin->disabled) return false;
+
+            WaveEffectInput input = { time, ledCount, x.data(), y.data(), width, height, params, (uint32_t)paramCount };
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            plugin->api->render(plugin->state, &input, (WaveEffectRGB*)out);
+            std::chrono::steady_clock::duration took = std::chrono::steady_clock::now() - start;
+
+            uint32_t micros = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(took).count();
+            plugin->frames++;
+            plugin->lastFrame = micros;
+            plugin->maxFrame = std::max(plugin->maxFrame, micros);
+
+            plugin->overBudget = took > budget ? plugin->overBudget + 1 : 0;
+            if(plugin->overBudget >= OVER_BUDGET_LIMIT) {
+                printf(
+                    "Effect plugin %s took over %lldus for %zu frames, leaving it out until it is reloaded\n",
+                    plugin->name.c_str(), (long long)budget.count(), OVER_BUDGET_LIMIT
+                );
+
+                plugin->disabled = true;
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // any thread, the stats are printed on the render thread's next swap
+    void request_stats() {
+        printing = true;
+    }
+};
+
+#endif
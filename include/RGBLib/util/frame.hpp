@@ -0,0 +1,68 @@
+#ifndef __RGBLIB_FRAME_HPP__
+#define __RGBLIB_FRAME_HPP__
+
+#include "rgb.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <bitset>
+
+// framebuffer of N entries addressed by a uint8_t led/col id.
+// only the entries in the mask get sent to the device.
+// the size is part of the type so every loop over a frame has a constant trip count
+template<size_t N>
+struct BasicFrame {
+    static_assert(N > 0 && N <= 256, "frames are addressed by a uint8_t");
+
+    static constexpr size_t SIZE = N;
+
+    RGB colors[N];
+    std::bitset<N> mask;
+
+    BasicFrame() {
+        clear();
+    }
+
+    void set(uint8_t index, RGB rgb) {
+        if(index >= N) return;
+
+        colors[index] = rgb;
+        mask.set(index);
+    }
+
+    void unset(uint8_t index) {
+        if(index >= N) return;
+
+        mask.reset(index);
+    }
+
+    bool has(uint8_t index) const {
+        return index < N && mask.test(index);
+    }
+
+    // sets every entry to rgb
+    void fill(RGB rgb) {
+        for(size_t i = 0; i < N; i++) {
+            colors[i] = rgb;
+        }
+
+        mask.set();
+    }
+
+    void clear() {
+        for(size_t i = 0; i < N; i++) {
+            colors[i] = { 0x00, 0x00, 0x00 };
+        }
+
+        mask.reset();
+    }
+
+    size_t count() const {
+        return mask.count();
+    }
+};
+
+// the largest frame a uint8_t can address, for devices without their own traits
+typedef BasicFrame<256> Frame;
+
+#endif
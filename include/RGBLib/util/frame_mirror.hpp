@@ -0,0 +1,261 @@
+#ifndef __RGBLIB_FRAME_MIRROR_HPP__
+#define __RGBLIB_FRAME_MIRROR_HPP__
+
+#include "rgb.hpp"
+#include "shared_frames.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <atomic>
+#include <string>
+#include <algorithm>
+
+// what one device showed last, as written to the mirror
+struct FrameMirrorFrame {
+    static constexpr size_t MAX_LEDS = 256;
+    static constexpr size_t MAX_ENCODED = 4096;
+
+    // frames this device has published, 0 before the first
+    uint64_t frame;
+    // CLOCK_MONOTONIC nanoseconds when the frame was sent, see sharedFrameClock
+    uint64_t timestamp;
+
+    uint32_t ledCount;
+    RGB colors[MAX_LEDS];
+
+    // the bytes the device was sent for the frame, in the driver's wire format.
+    // encodedLength is what was sent, only the first MAX_ENCODED bytes are kept
+    uint32_t encodedLength;
+    uint8_t encoded[MAX_ENCODED];
+};
+
+// one device's part of the mirror. seq is odd while the daemon writes the frame, readers retry when it changed under them
+struct FrameMirrorSlot {
+    static constexpr size_t NAME_LENGTH = 32;
+
+    char name[NAME_LENGTH];
+
+    std::atomic<uint64_t> seq;
+    // bumped with every frame, a futex readers can sleep on
+    std::atomic<uint32_t> wake;
+
+    FrameMirrorFrame frame;
+};
+
+// the layout of /dev/shm/<name>, written by the daemon and mapped read only by its readers
+struct FrameMirrorHeader {
+    static constexpr uint32_t MAGIC = 0x5746524D;
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t MAX_DEVICES = 8;
+
+    uint32_t magic;
+    uint32_t version;
+
+    // slots in use, only ever grows
+    std::atomic<uint32_t> deviceCount;
+
+    FrameMirrorSlot device[MAX_DEVICES];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the mirror's atomics have to work across processes");
+
+// the daemon's end. each device is published by the one thread that draws it, so publishing never waits on anything
+class FrameMirror {
+private:
+    std::string name;
+    FrameMirrorHeader* header;
+
+public:
+    FrameMirror() : header(nullptr) {}
+
+    ~FrameMirror() {
+        close();
+    }
+
+    // name is a posix shm name like "/waveeffect-mirror". false if it could not be made.
+    // the keyboard's frames have the ripples of every key pressed in them, so by default only the daemon's user can read it.
+    // anyone else's overlay only follows it with a mode like 0644 given here
+    bool create(const char* name, mode_t mode = 0600) {
+        close();
+
+        void* memory = createSharedRegion(name, sizeof(FrameMirrorHeader), mode, "frame mirror");
+        if(!memory) return false;
+
+        this->name = name;
+        header = (FrameMirrorHeader*)memory;
+
+        header->version = FrameMirrorHeader::VERSION;
+        publishSharedMagic(&header->magic, FrameMirrorHeader::MAGIC);
+
+        return true;
+    }
+
+    void close() {
+        if(!header) return;
+
+        munmap(header, sizeof(FrameMirrorHeader));
+        shm_unlink(name.c_str());
+
+        header = nullptr;
+    }
+
+    bool is_open() { return header != nullptr; }
+
+    // devices have to be added before any thread publishes, returns the device's index or SIZE_MAX
+    size_t add(const char* device, uint32_t ledCount) {
+        if(!header) return SIZE_MAX;
+
+        uint32_t index = header->deviceCount.load(std::memory_order_relaxed);
+        if(index >= FrameMirrorHeader::MAX_DEVICES) return SIZE_MAX;
+
+        FrameMirrorSlot& slot = header->device[index];
+        strncpy(slot.name, device, FrameMirrorSlot::NAME_LENGTH - 1);
+        slot.frame.ledCount = std::min<uint32_t>(ledCount, FrameMirrorFrame::MAX_LEDS);
+
+        header->deviceCount.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    // copies the frame device just sent into the mirror and wakes anyone waiting on it.
+    // only the thread drawing device may call this, a bad index is ignored
+    void publish(size_t device, const RGB* colors, size_t count, const uint8_t* encoded, size_t encodedLength) {
+        if(!header || device >= header->deviceCount.load(std::memory_order_relaxed)) return;
+
+        FrameMirrorSlot& slot = header->device[device];
+        FrameMirrorFrame& frame = slot.frame;
+
+        uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        frame.frame++;
+        frame.timestamp = sharedFrameClock();
+
+        count = std::min<size_t>(count, frame.ledCount);
+        memcpy((void*)frame.colors, (const void*)colors, count * sizeof(RGB));
+
+        frame.encodedLength = (uint32_t)encodedLength;
+        if(encodedLength) memcpy(frame.encoded, encoded, std::min(encodedLength, FrameMirrorFrame::MAX_ENCODED));
+
+        slot.seq.store(seq + 2, std::memory_order_release);
+
+        // one syscall a frame, readers map the region read only so they cannot say whether anyone sleeps
+        slot.wake.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &slot.wake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+};
+
+enum FrameMirrorRead {
+    MIRROR_READ_FRAME = 0,
+    // the device has not published anything yet, or there is no such device
+    MIRROR_READ_NONE,
+    // the daemon kept writing it over every try, worth trying again later
+    MIRROR_READ_TORN
+};
+
+// a reader's end, maps the mirror read only so nothing a reader does can reach the daemon
+class FrameMirrorReader {
+public:
+    static constexpr size_t READ_ATTEMPTS = 16;
+
+private:
+    const FrameMirrorHeader* header;
+
+public:
+    FrameMirrorReader() : header(nullptr) {}
+
+    ~FrameMirrorReader() {
+        if(header) munmap((void*)header, sizeof(FrameMirrorHeader));
+    }
+
+    // false while the daemon has not made the mirror yet
+    bool open(const char* name) {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if(fd == -1) return false;
+
+        void* memory = mmap(nullptr, sizeof(FrameMirrorHeader), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if(memory == MAP_FAILED) return false;
+
+        const FrameMirrorHeader* mapped = (const FrameMirrorHeader*)memory;
+        if(mapped->magic != FrameMirrorHeader::MAGIC || mapped->version != FrameMirrorHeader::VERSION) {
+            munmap(memory, sizeof(FrameMirrorHeader));
+            return false;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        header = mapped;
+        return true;
+    }
+
+    size_t getDeviceCount() {
+        return header ? header->deviceCount.load(std::memory_order_acquire) : 0;
+    }
+
+    // nullptr past the last device
+    const char* getDeviceName(size_t device) {
+        return device < getDeviceCount() ? header->device[device].name : nullptr;
+    }
+
+    // copies the device's newest frame into out. the daemon writes a frame in a few microseconds,
+    // so between tries the cpu is given up to let it finish, one preempted mid write can still tear every try
+    FrameMirrorRead read(size_t device, FrameMirrorFrame& out) {
+        if(device >= getDeviceCount()) return MIRROR_READ_NONE;
+
+        const FrameMirrorSlot& slot = header->device[device];
+
+        for(size_t attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+            if(attempt > 0) sched_yield();
+
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if(seq % 2) continue;
+
+            memcpy((void*)&out, (const void*)&slot.frame, sizeof(FrameMirrorFrame));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.seq.load(std::memory_order_relaxed) != seq) continue;
+
+            return out.frame > 0 ? MIRROR_READ_FRAME : MIRROR_READ_NONE;
+        }
+
+        return MIRROR_READ_TORN;
+    }
+
+    // sleeps until the device publishes a frame after lastFrame or timeoutMs passed, false on timeout
+    bool wait(size_t device, uint64_t lastFrame, long timeoutMs) {
+        if(device >= getDeviceCount()) return false;
+
+        const FrameMirrorSlot& slot = header->device[device];
+
+        uint64_t deadline = sharedFrameClock() + timeoutMs * 1000000ULL;
+        while(true) {
+            uint32_t wake = slot.wake.load(std::memory_order_acquire);
+
+            // every frame moves seq on by 2
+            if(slot.seq.load(std::memory_order_acquire) / 2 > lastFrame) return true;
+
+            uint64_t now = sharedFrameClock();
+            if(now >= deadline) return false;
+
+            struct timespec timeout = { (time_t)((deadline - now) / 1000000000ULL), (long)((deadline - now) % 1000000000ULL) };
+            syscall(SYS_futex, &slot.wake, FUTEX_WAIT, wake, &timeout, nullptr, 0);
+        }
+    }
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "rgb.hpp"
 
 #include <math.h>
+#include <stddef.h>
 
 struct HSV {
     double H;
@@ -86,4 +87,46 @@ RGB HSVToRGB(HSV hsv) {
 	return rgb;
 }
 
+// 0..1 weight of one rgb channel at position k around the hue circle, min(k, 4 - k) clamped to 0..1
+// written with fabsf only so the batch loop has no branches
+static inline float HSVChannelWeight(float k) {
+    k -= 6.0f * (float)(int)(k * (1.0f / 6.0f));
+
+    float x = 2.0f - fabsf(k - 2.0f);
+    return 0.5f * (fabsf(x) - fabsf(x - 1.0f) + 1.0f);
+}
+
+// HSVToRGB over arrays of hue/saturation/value (H in degrees) that vectorizes
+void HSVToRGBBatch(const float* h, const float* s, const float* v, RGB* out, size_t count) {
+    const size_t CHUNK = 64;
+
+    float r[CHUNK];
+    float g[CHUNK];
+    float b[CHUNK];
+
+    for(size_t start = 0; start < count; start += CHUNK) {
+        size_t chunkLen = count - start < CHUNK ? count - start : CHUNK;
+
+        for(size_t i = 0; i < chunkLen; i++) {
+            float hue = h[start + i];
+            float value = v[start + i];
+            float chroma = value * s[start + i];
+
+            // keeps the sector positive for hues down to -360
+            float sector = hue * (1.0f / 60.0f);
+            sector = sector - 6.0f * (float)(int)(sector * (1.0f / 6.0f)) + 6.0f;
+
+            r[i] = (value - chroma * HSVChannelWeight(5.0f + sector)) * 255.0f;
+            g[i] = (value - chroma * HSVChannelWeight(3.0f + sector)) * 255.0f;
+            b[i] = (value - chroma * HSVChannelWeight(1.0f + sector)) * 255.0f;
+        }
+
+        for(size_t i = 0; i < chunkLen; i++) {
+            out[start + i].red = r[i];
+            out[start + i].green = g[i];
+            out[start + i].blue = b[i];
+        }
+    }
+}
+
 #endif
\ No newline at end of file
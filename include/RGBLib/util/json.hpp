@@ -0,0 +1,299 @@
+#ifndef __RGBLIB_JSON_HPP__
+#define __RGBLIB_JSON_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+enum JSONType {
+    JSON_NULL = 0,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+};
+
+struct JSONValue {
+    JSONType type = JSON_NULL;
+
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+
+    std::vector<JSONValue> items;
+    // in file order
+    std::vector<std::pair<std::string, JSONValue>> members;
+
+    // nullptr if this is not an object or has no such member
+    const JSONValue* get(const char* key) const {
+        for(const std::pair<std::string, JSONValue>& member : members) {
+            if(member.first == key) return &member.second;
+        }
+
+        return nullptr;
+    }
+
+    bool isNull() const { return type == JSON_NULL; }
+    bool isNumber() const { return type == JSON_NUMBER; }
+    bool isString() const { return type == JSON_STRING; }
+    bool isArray() const { return type == JSON_ARRAY; }
+    bool isObject() const { return type == JSON_OBJECT; }
+};
+
+// recursive descent over rfc 8259 json, only meant for small config files.
+// numbers are whatever strtod makes of them, the error says the line it happened on
+class JSONParser {
+private:
+    static const size_t MAX_DEPTH = 64;
+
+    const char* pos;
+    const char* end;
+    size_t line;
+    size_t depth;
+
+    std::string error;
+
+    bool fail(const char* message) {
+        if(error.empty()) error = "line " + std::to_string(line) + ": " + message;
+        return false;
+    }
+
+    void skipWhitespace() {
+        while(pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n')) {
+            if(*pos == '\n') line++;
+            pos++;
+        }
+    }
+
+    bool literal(const char* word) {
+        for(; *word; word++, pos++) {
+            if(pos >= end || *pos != *word) return fail("unknown literal");
+        }
+
+        return true;
+    }
+
+    static void appendUTF8(std::string& out, uint32_t codepoint) {
+        if(codepoint < 0x80) {
+            out += (char)codepoint;
+        }
+        else if(codepoint < 0x800) {
+            out += (char)(0xC0 | (codepoint >> 6));
+            out += (char)(0x80 | (codepoint & 0x3F));
+        }
+        else if(codepoint < 0x10000) {
+            out += (char)(0xE0 | (codepoint >> 12));
+            out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+            out += (char)(0x80 | (codepoint & 0x3F));
+        }
+        else {
+            out += (char)(0xF0 | (codepoint >> 18));
+            out += (char)(0x80 | ((codepoint >> 12) & 0x3F));
+            out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+            out += (char)(0x80 | (codepoint & 0x3F));
+        }
+    }
+
+    bool hex4(uint32_t& out) {
+        if(end - pos < 4) return fail("truncated \\u escape");
+
+        out = 0;
+        for(size_t i = 0; i < 4; i++, pos++) {
+            char c = *pos;
+            out <<= 4;
+
+            if(c >= '0' && c <= '9') out |= c - '0';
+            else if(c >= 'a' && c <= 'f') out |= c - 'a' + 10;
+            else if(c >= 'A' && c <= 'F') out |= c - 'A' + 10;
+            else return fail("bad \\u escape");
+        }
+
+        return true;
+    }
+
+    bool parseString(std::string& out) {
+        // past the opening quote
+        pos++;
+
+        while(pos < end && *pos != '"') {
+            char c = *pos++;
+            if((unsigned char)c < 0x20) return fail("control character in string");
+
+            if(c != '\\') {
+                out += c;
+                continue;
+            }
+
+            if(pos >= end) break;
+
+            switch(*pos++) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t codepoint = 0;
+                if(!hex4(codepoint)) return false;
+
+                // surrogate pair
+                if(codepoint >= 0xD800 && codepoint < 0xDC00 && end - pos >= 6 && pos[0] == '\\' && pos[1] == 'u') {
+                    pos += 2;
+
+                    uint32_t low = 0;
+                    if(!hex4(low)) return false;
+                    if(low < 0xDC00 || low >= 0xE000) return fail("bad surrogate pair");
+
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+
+                appendUTF8(out, codepoint);
+                break;
+            }
+            default: return fail("bad escape");
+            }
+        }
+
+        if(pos >= end) return fail("unterminated string");
+
+        pos++;
+        return true;
+    }
+
+    bool parseNumber(double& out) {
+        const char* start = pos;
+
+        if(pos < end && *pos == '-') pos++;
+        if(pos >= end || *pos < '0' || *pos > '9') return fail("bad number");
+
+        while(pos < end && ((*pos >= '0' && *pos <= '9') || *pos == '.' || *pos == 'e' || *pos == 'E' || *pos == '+' || *pos == '-')) {
+            pos++;
+        }
+
+        std::string text(start, pos);
+        char* parsedEnd;
+        out = strtod(text.c_str(), &parsedEnd);
+
+        if(*parsedEnd != '\0') return fail("bad number");
+        return true;
+    }
+
+    bool parseValue(JSONValue& out) {
+        if(++depth > MAX_DEPTH) return fail("nested too deep");
+
+        skipWhitespace();
+        if(pos >= end) return fail("unexpected end of file");
+
+        bool ok = true;
+        switch(*pos) {
+        case 'n': out.type = JSON_NULL; ok = literal("null"); break;
+        case 't': out.type = JSON_BOOL; out.boolean = true; ok = literal("true"); break;
+        case 'f': out.type = JSON_BOOL; out.boolean = false; ok = literal("false"); break;
+        case '"': out.type = JSON_STRING; ok = parseString(out.string); break;
+        case '[': {
+            out.type = JSON_ARRAY;
+            pos++;
+
+            skipWhitespace();
+            if(pos < end && *pos == ']') {
+                pos++;
+                break;
+            }
+
+            while(ok) {
+                out.items.emplace_back();
+                if(!parseValue(out.items.back())) return false;
+
+                skipWhitespace();
+                if(pos < end && *pos == ',') {
+                    pos++;
+                    continue;
+                }
+
+                if(pos < end && *pos == ']') {
+                    pos++;
+                    break;
+                }
+
+                ok = fail("expected , or ]");
+            }
+
+            break;
+        }
+        case '{': {
+            out.type = JSON_OBJECT;
+            pos++;
+
+            skipWhitespace();
+            if(pos < end && *pos == '}') {
+                pos++;
+                break;
+            }
+
+            while(ok) {
+                skipWhitespace();
+                if(pos >= end || *pos != '"') return fail("expected a member name");
+
+                out.members.emplace_back();
+                if(!parseString(out.members.back().first)) return false;
+
+                skipWhitespace();
+                if(pos >= end || *pos != ':') return fail("expected :");
+                pos++;
+
+                if(!parseValue(out.members.back().second)) return false;
+
+                skipWhitespace();
+                if(pos < end && *pos == ',') {
+                    pos++;
+                    continue;
+                }
+
+                if(pos < end && *pos == '}') {
+                    pos++;
+                    break;
+                }
+
+                ok = fail("expected , or }");
+            }
+
+            break;
+        }
+        default: out.type = JSON_NUMBER; ok = parseNumber(out.number); break;
+        }
+
+        depth--;
+        return ok;
+    }
+
+public:
+    // false with error set if text is not exactly one json value
+    bool parse(const std::string& text, JSONValue& out) {
+        pos = text.data();
+        end = text.data() + text.size();
+        line = 1;
+        depth = 0;
+        error.clear();
+
+        out = JSONValue();
+        if(!parseValue(out)) return false;
+
+        skipWhitespace();
+        if(pos != end) return fail("trailing characters");
+
+        return true;
+    }
+
+    const std::string& getError() { return error; }
+};
+
+#endif
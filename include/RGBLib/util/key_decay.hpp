@@ -0,0 +1,119 @@
+#ifndef __RGBLIB_KEY_DECAY_HPP__
+#define __RGBLIB_KEY_DECAY_HPP__
+
+#include "rgb.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#include <atomic>
+#include <algorithm>
+
+enum DecayCurve {
+    DECAY_LINEAR = 0,
+    DECAY_EXPONENTIAL
+};
+
+struct KeyDecayConfig {
+    DecayCurve curve = DECAY_LINEAR;
+
+    // linear: frames from a press back to full brightness
+    size_t frames = 5;
+    // exponential: intensity kept every frame
+    float factor = 0.6f;
+
+    // how far a fresh press dims the key, 255 is black
+    uint8_t depth = 230;
+};
+
+// per led dim intensity in a fixed array, 255 right after a press and 0 when untouched.
+// presses are queued lock free from the input threads and picked up by step()
+class KeyDecay {
+public:
+    static constexpr size_t MAX_LEDS = 256;
+
+private:
+    uint8_t depth;
+
+    // intensity after one frame, indexed by intensity
+    uint8_t next[256];
+
+    uint8_t intensity[MAX_LEDS];
+    std::atomic<uint64_t> pressed[MAX_LEDS / 64];
+
+    // per channel multiplier of the last step, 256 is unchanged
+    uint16_t factors[MAX_LEDS * 3];
+
+public:
+    KeyDecay(KeyDecayConfig config = KeyDecayConfig()) {
+        setCurve(config);
+
+        std::fill(intensity, intensity + MAX_LEDS, 0);
+        std::fill(factors, factors + MAX_LEDS * 3, 256);
+
+        for(std::atomic<uint64_t>& word : pressed) {
+            word = 0;
+        }
+    }
+
+    void setCurve(KeyDecayConfig config) {
+        depth = config.depth;
+
+        for(size_t i = 0; i < 256; i++) {
+            switch(config.curve) {
+            case DECAY_EXPONENTIAL: next[i] = (uint8_t)floorf(i * config.factor); break;
+            default: next[i] = (uint8_t)std::max<long>((long)i - (long)(255 / std::max<size_t>(config.frames, 1)), 0); break;
+            }
+        }
+    }
+
+    // any curve, lut[i] is the intensity one frame after intensity i
+    void setCurve(const uint8_t lut[256], uint8_t depth) {
+        this->depth = depth;
+        std::copy(lut, lut + 256, next);
+    }
+
+    void press(uint8_t led) {
+        pressed[led / 64].fetch_or(1ULL << (led % 64), std::memory_order_relaxed);
+    }
+
+    uint8_t getIntensity(uint8_t led) { return intensity[led]; }
+
+    // takes queued presses and advances every led one frame
+    void step(size_t count) {
+        count = std::min(count, MAX_LEDS);
+
+        for(size_t led = 0; led < count; led++) {
+            intensity[led] = next[intensity[led]];
+        }
+
+        for(size_t word = 0; word < MAX_LEDS / 64; word++) {
+            uint64_t bits = pressed[word].exchange(0, std::memory_order_relaxed);
+
+            for(size_t bit = 0; bits; bit++, bits >>= 1) {
+                if(bits & 1) intensity[word * 64 + bit] = 0xFF;
+            }
+        }
+
+        for(size_t led = 0; led < count; led++) {
+            uint16_t factor = 256 - ((intensity[led] * depth) >> 8);
+
+            factors[led * 3] = factor;
+            factors[led * 3 + 1] = factor;
+            factors[led * 3 + 2] = factor;
+        }
+    }
+
+    // dims leds by the intensities of the last step, one multiply per byte
+    void apply(RGB* leds, size_t count) {
+        count = std::min(count, MAX_LEDS);
+
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(leds);
+        for(size_t i = 0; i < count * 3; i++) {
+            bytes[i] = (bytes[i] * factors[i]) >> 8;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef __RGBLIB_LED_OVERLAY_HPP__
+#define __RGBLIB_LED_OVERLAY_HPP__
+
+#include "rgb.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <optional>
+
+// a copy of an LEDOverlay at one generation
+struct LEDOverlaySnapshot {
+    static constexpr size_t MAX_LEDS = 256;
+
+    uint64_t generation;
+
+    // 0x00RRGGBB
+    uint32_t colors[MAX_LEDS];
+    uint64_t occupancy[MAX_LEDS / 64];
+
+    bool has(uint8_t led) const {
+        return occupancy[led / 64] & (1ULL << (led % 64));
+    }
+
+    RGB get(uint8_t led) const {
+        return { (uint8_t)(colors[led] >> 16), (uint8_t)(colors[led] >> 8), (uint8_t)colors[led] };
+    }
+
+    size_t count() const {
+        size_t count = 0;
+        for(uint64_t word : occupancy) {
+            count += __builtin_popcountll(word);
+        }
+
+        return count;
+    }
+};
+
+// per led colours written from any thread without locks.
+// every change bumps the generation so readers can tell nothing changed from one load
+class LEDOverlay {
+public:
+    static constexpr size_t MAX_LEDS = LEDOverlaySnapshot::MAX_LEDS;
+
+private:
+    std::atomic<uint32_t> colors[MAX_LEDS];
+    std::atomic<uint64_t> occupancy[MAX_LEDS / 64];
+    std::atomic<uint64_t> generation;
+
+    static uint32_t pack(RGB rgb) {
+        return (rgb.red << 16) | (rgb.green << 8) | rgb.blue;
+    }
+
+public:
+    LEDOverlay() {
+        for(std::atomic<uint32_t>& color : colors) {
+            color = 0;
+        }
+
+        for(std::atomic<uint64_t>& word : occupancy) {
+            word = 0;
+        }
+
+        generation = 0;
+    }
+
+    void set(uint8_t led, RGB rgb) {
+        uint64_t bit = 1ULL << (led % 64);
+
+        uint32_t previous = colors[led].exchange(pack(rgb), std::memory_order_relaxed);
+        uint64_t word = occupancy[led / 64].fetch_or(bit, std::memory_order_relaxed);
+
+        // setting the same colour again is not a change
+        if((word & bit) && previous == pack(rgb)) return;
+
+        generation.fetch_add(1, std::memory_order_release);
+    }
+
+    void unset(uint8_t led) {
+        uint64_t bit = 1ULL << (led % 64);
+
+        if(!(occupancy[led / 64].fetch_and(~bit, std::memory_order_relaxed) & bit)) return;
+        generation.fetch_add(1, std::memory_order_release);
+    }
+
+    void clear() {
+        bool changed = false;
+        for(std::atomic<uint64_t>& word : occupancy) {
+            changed |= word.exchange(0, std::memory_order_relaxed) != 0;
+        }
+
+        if(changed) generation.fetch_add(1, std::memory_order_release);
+    }
+
+    std::optional<RGB> get(uint8_t led) {
+        if(!(occupancy[led / 64].load(std::memory_order_relaxed) & (1ULL << (led % 64)))) {
+            return std::optional<RGB>();
+        }
+
+        uint32_t color = colors[led].load(std::memory_order_relaxed);
+        return std::optional<RGB>({ (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)color });
+    }
+
+    uint64_t getGeneration() {
+        return generation.load(std::memory_order_acquire);
+    }
+
+    // a straight copy of the arrays, taken again if a writer changed them meanwhile
+    void snapshot(LEDOverlaySnapshot& out) {
+        for(size_t attempt = 0; attempt < 4; attempt++) {
+            out.generation = generation.load(std::memory_order_acquire);
+
+            for(size_t led = 0; led < MAX_LEDS; led++) {
+                out.colors[led] = colors[led].load(std::memory_order_relaxed);
+            }
+
+            for(size_t word = 0; word < MAX_LEDS / 64; word++) {
+                out.occupancy[word] = occupancy[word].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(generation.load(std::memory_order_relaxed) == out.generation) return;
+        }
+    }
+};
+
+#endif
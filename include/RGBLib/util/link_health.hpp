@@ -0,0 +1,114 @@
+#ifndef __RGBLIB_LINK_HEALTH_HPP__
+#define __RGBLIB_LINK_HEALTH_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+
+struct LinkHealthSnapshot {
+    // bucket i counts round trips under 2^i * 125us, the last one everything slower
+    static constexpr size_t BUCKETS = 10;
+
+    size_t probes;
+    size_t timeouts;
+    size_t samples;
+
+    size_t histogram[BUCKETS];
+
+    // over the rolling window, in microseconds
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+};
+
+// round trip times of the last WINDOW probes of one device
+class LinkHealth {
+public:
+    static constexpr size_t WINDOW = 128;
+
+private:
+    std::mutex mutex;
+
+    uint32_t window[WINDOW];
+    size_t windowPos;
+    size_t windowSize;
+
+    size_t probes;
+    size_t timeouts;
+
+public:
+    LinkHealth() {
+        reset();
+    }
+
+    void record(std::chrono::steady_clock::duration rtt) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        window[windowPos] = (uint32_t)std::min<long long>(std::chrono::duration_cast<std::chrono::microseconds>(rtt).count(), UINT32_MAX);
+        windowPos = (windowPos + 1) % WINDOW;
+        windowSize = std::min(windowSize + 1, WINDOW);
+
+        probes++;
+    }
+
+    void recordTimeout() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        probes++;
+        timeouts++;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        windowPos = 0;
+        windowSize = 0;
+
+        probes = 0;
+        timeouts = 0;
+    }
+
+    // median of the window, 0 without samples
+    std::chrono::microseconds median() {
+        return std::chrono::microseconds(snapshot().p50);
+    }
+
+    LinkHealthSnapshot snapshot() {
+        LinkHealthSnapshot snapshot = {};
+        uint32_t sorted[WINDOW];
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            snapshot.probes = probes;
+            snapshot.timeouts = timeouts;
+            snapshot.samples = windowSize;
+
+            std::copy(window, window + windowSize, sorted);
+        }
+
+        if(snapshot.samples == 0) return snapshot;
+
+        for(size_t i = 0; i < snapshot.samples; i++) {
+            size_t bucket = 0;
+            while(bucket < LinkHealthSnapshot::BUCKETS - 1 && sorted[i] >= (125u << bucket)) bucket++;
+
+            snapshot.histogram[bucket]++;
+        }
+
+        std::sort(sorted, sorted + snapshot.samples);
+
+        snapshot.p50 = sorted[(snapshot.samples - 1) * 50 / 100];
+        snapshot.p90 = sorted[(snapshot.samples - 1) * 90 / 100];
+        snapshot.p99 = sorted[(snapshot.samples - 1) * 99 / 100];
+        snapshot.max = sorted[snapshot.samples - 1];
+
+        return snapshot;
+    }
+};
+
+#endif
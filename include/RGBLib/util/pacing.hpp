@@ -0,0 +1,111 @@
+#ifndef __RGBLIB_PACING_HPP__
+#define __RGBLIB_PACING_HPP__
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+// all times are in microseconds
+struct ReportPacerConfig {
+    // bounds the gap between two reports is kept in
+    double minGap = 100;
+    double maxGap = 8000;
+    double initialGap = 1000;
+
+    // subtracted from the gap after every fast successful write
+    double additiveDecrease = 25;
+    // the gap is multiplied by this on a failed or slow write
+    double multiplicativeIncrease = 2.0;
+
+    // a write taking longer than this means the endpoint is backed up
+    double slowWriteThreshold = 2000;
+
+    // weight of the newest gap in the exported steady state gap
+    double steadyStateWeight = 0.05;
+};
+
+// AIMD controller for the gap between HID reports.
+// the gap shrinks linearly while writes complete quickly and backs off
+// multiplicatively as soon as a write fails or blocks on the bus.
+// only the getters may be called from any thread, the rest under the device's lock
+class ReportPacer {
+private:
+    ReportPacerConfig config;
+
+    double gap;
+    std::atomic<double> steadyStateGap;
+    std::atomic<double> lastWriteTime;
+
+    std::atomic<size_t> writes;
+    std::atomic<size_t> errors;
+
+    std::chrono::steady_clock::time_point lastWrite;
+
+public:
+    ReportPacer(ReportPacerConfig config = ReportPacerConfig()) : config(config) {
+        this->gap = std::clamp(config.initialGap, config.minGap, config.maxGap);
+        this->steadyStateGap = this->gap;
+        this->lastWriteTime = 0;
+
+        this->writes = 0;
+        this->errors = 0;
+
+        this->lastWrite = std::chrono::steady_clock::time_point();
+    }
+
+    // sleeps until the current gap has passed since the last write completed
+    void wait() {
+        std::chrono::steady_clock::time_point next = lastWrite + std::chrono::microseconds((long long)gap);
+
+        if(std::chrono::steady_clock::now() < next) {
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    void record(std::chrono::steady_clock::duration writeDuration, bool success) {
+        double writeTime = std::chrono::duration<double, std::micro>(writeDuration).count();
+
+        if(!success || writeTime > config.slowWriteThreshold) {
+            gap *= config.multiplicativeIncrease;
+        }
+        else {
+            gap -= config.additiveDecrease;
+        }
+
+        gap = std::clamp(gap, config.minGap, config.maxGap);
+
+        steadyStateGap = steadyStateGap + (gap - steadyStateGap) * config.steadyStateWeight;
+        lastWriteTime = writeTime;
+
+        writes++;
+        if(!success) errors++;
+
+        lastWrite = std::chrono::steady_clock::now();
+    }
+
+    // a probe that timed out or took longer than a slow write means the link is struggling
+    void recordProbe(std::chrono::steady_clock::duration rtt, bool success) {
+        double rttTime = std::chrono::duration<double, std::micro>(rtt).count();
+        if(success && rttTime <= config.slowWriteThreshold) return;
+
+        gap = std::clamp(gap * config.multiplicativeIncrease, config.minGap, config.maxGap);
+    }
+
+    // forget everything learned about the link, e.g. after a reconnect
+    void reset() {
+        gap = std::clamp(config.initialGap, config.minGap, config.maxGap);
+        steadyStateGap = gap;
+
+        lastWrite = std::chrono::steady_clock::time_point();
+    }
+
+    std::chrono::microseconds getGap() { return std::chrono::microseconds((long long)gap); }
+    std::chrono::microseconds getSteadyStateGap() { return std::chrono::microseconds((long long)steadyStateGap); }
+    std::chrono::microseconds getLastWriteTime() { return std::chrono::microseconds((long long)lastWriteTime); }
+
+    size_t getWrites() { return writes; }
+    size_t getErrors() { return errors; }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef __RGBLIB_SHARED_FRAMES_HPP__
+#define __RGBLIB_SHARED_FRAMES_HPP__
+
+#include "rgb.hpp"
+#include "link_health.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <algorithm>
+
+// the layout of a frame ring in shared memory, the same for the daemon and every producer.
+// a producer writes straight into the next slot and publishes it, the daemon only ever reads the newest.
+// each slot is a seqlock: its seq is 2 * frame - 1 while frame is written and 2 * frame once it is done,
+// so a reader can tell a torn slot and a slot the producer has lapped from the frame it wanted
+struct SharedFrameSlot {
+    static constexpr size_t MAX_LEDS = 256;
+
+    std::atomic<uint64_t> seq;
+    // CLOCK_MONOTONIC nanoseconds when the producer published it
+    uint64_t timestamp;
+
+    // leds not in the mask are left to the effects under the layer
+    uint64_t mask[MAX_LEDS / 64];
+    RGB colors[MAX_LEDS];
+};
+
+struct SharedFrameHeader {
+    static constexpr uint32_t MAGIC = 0x57465246;
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t SLOTS = 4;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    // leds of the device the ring feeds
+    uint32_t ledCount;
+
+    // frames published, the newest is in slot (published - 1) % slots
+    std::atomic<uint64_t> published;
+    // the newest frame the daemon has taken
+    std::atomic<uint64_t> consumed;
+    // bumped with every consumed frame, a futex producers can sleep on
+    std::atomic<uint32_t> consumedWake;
+
+    SharedFrameSlot slot[SLOTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring's atomics have to work across processes");
+
+// CLOCK_MONOTONIC, the clock both sides stamp frames with
+inline uint64_t sharedFrameClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// makes /dev/shm/<name> size bytes, zeroed and mapped read write, nullptr if it could not be made.
+// whatever was left behind at name is replaced rather than reused, whoever made it.
+// mode is what other users get, 0600 keeps it to the daemon's own user
+inline void* createSharedRegion(const char* name, size_t size, mode_t mode, const char* what) {
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, mode);
+    if(fd == -1) {
+        printf("Failed to create %s %s: %s\n", what, name, strerror(errno));
+        return nullptr;
+    }
+
+    void* memory = MAP_FAILED;
+    if(ftruncate(fd, size) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    ::close(fd);
+
+    if(memory == MAP_FAILED) {
+        printf("Failed to map %s %s: %s\n", what, name, strerror(errno));
+        shm_unlink(name);
+
+        return nullptr;
+    }
+
+    memset(memory, 0, size);
+    return memory;
+}
+
+// the other side waits for the magic before trusting the rest of the region, so it is written last
+inline void publishSharedMagic(uint32_t* field, uint32_t magic) {
+    std::atomic_thread_fence(std::memory_order_release);
+    *field = magic;
+}
+
+// the daemon's end, owns /dev/shm/<name>
+class SharedFrameRing {
+private:
+    std::string name;
+    SharedFrameHeader* header;
+
+    // clamped in create, the header's copy can be rewritten by any producer
+    uint32_t ledCount;
+
+    uint64_t lastFrame;
+
+    // producer write to hid submit of every frame shown
+    LinkHealth latency;
+    std::atomic<size_t> frames;
+    std::atomic<size_t> stale;
+
+public:
+    SharedFrameRing() : header(nullptr), ledCount(0), lastFrame(0) {
+        frames = 0;
+        stale = 0;
+    }
+
+    ~SharedFrameRing() {
+        close();
+    }
+
+    // name is a posix shm name like "/waveeffect-keyboard", only the daemon's user can open it. false if it could not be made
+    bool create(const char* name, uint32_t ledCount) {
+        close();
+
+        void* memory = createSharedRegion(name, sizeof(SharedFrameHeader), 0600, "shared frame ring");
+        if(!memory) return false;
+
+        this->name = name;
+        header = (SharedFrameHeader*)memory;
+
+        header->version = SharedFrameHeader::VERSION;
+        header->slots = SharedFrameHeader::SLOTS;
+        this->ledCount = std::min<uint32_t>(ledCount, SharedFrameSlot::MAX_LEDS);
+        header->ledCount = this->ledCount;
+
+        publishSharedMagic(&header->magic, SharedFrameHeader::MAGIC);
+
+        lastFrame = 0;
+        return true;
+    }
+
+    void close() {
+        if(!header) return;
+
+        munmap(header, sizeof(SharedFrameHeader));
+        shm_unlink(name.c_str());
+
+        header = nullptr;
+    }
+
+    bool is_open() { return header != nullptr; }
+
+    uint32_t getLEDCount() { return header ? ledCount : 0; }
+
+    // copies the newest frame published since the last take, false if there is none or it is older than maxAgeNs.
+    // never blocks a producer, a slot torn by one is skipped and picked up on the next take
+    bool take(SharedFrameSlot& out, uint64_t maxAgeNs) {
+        if(!header) return false;
+
+        uint64_t frame = header->published.load(std::memory_order_acquire);
+        if(frame == 0 || frame == lastFrame) return false;
+
+        SharedFrameSlot& slot = header->slot[(frame - 1) % SharedFrameHeader::SLOTS];
+
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if(seq != frame * 2) return false;
+
+        out.timestamp = slot.timestamp;
+        memcpy(out.mask, slot.mask, sizeof(out.mask));
+        memcpy((void*)out.colors, (const void*)slot.colors, ledCount * sizeof(RGB));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.seq.load(std::memory_order_relaxed) != seq) return false;
+
+        lastFrame = frame;
+
+        header->consumed.store(frame, std::memory_order_release);
+        header->consumedWake.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &header->consumedWake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+
+        if(sharedFrameClock() - out.timestamp > maxAgeNs) {
+            stale++;
+            return false;
+        }
+
+        return true;
+    }
+
+    // the frame taken at timestamp had its last report written just now
+    void submitted(uint64_t timestamp) {
+        frames++;
+        latency.record(std::chrono::nanoseconds(sharedFrameClock() - timestamp));
+    }
+
+    // latency from a producer publishing a frame to the device having it, in the window of the last frames
+    LinkHealthSnapshot get_latency() { return latency.snapshot(); }
+
+    size_t get_frames() { return frames; }
+    // frames taken too late to show
+    size_t get_stale() { return stale; }
+};
+
+// a producer's end, in the same header so games and scripts can link nothing but this
+class SharedFrameProducer {
+private:
+    SharedFrameHeader* header;
+    uint64_t frame;
+
+public:
+    SharedFrameProducer() : header(nullptr), frame(0) {}
+
+    ~SharedFrameProducer() {
+        if(header) munmap(header, sizeof(SharedFrameHeader));
+    }
+
+    // false while the daemon has not made the ring yet
+    bool open(const char* name) {
+        int fd = shm_open(name, O_RDWR, 0);
+        if(fd == -1) return false;
+
+        void* memory = mmap(nullptr, sizeof(SharedFrameHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if(memory == MAP_FAILED) return false;
+
+        SharedFrameHeader* mapped = (SharedFrameHeader*)memory;
+        if(mapped->magic != SharedFrameHeader::MAGIC || mapped->version != SharedFrameHeader::VERSION) {
+            munmap(memory, sizeof(SharedFrameHeader));
+            return false;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        header = mapped;
+        frame = header->published.load(std::memory_order_acquire);
+
+        return true;
+    }
+
+    // at most SharedFrameSlot::MAX_LEDS, whatever the header says
+    uint32_t getLEDCount() { return header ? std::min<uint32_t>(header->ledCount, SharedFrameSlot::MAX_LEDS) : 0; }
+
+    // the slot to draw the next frame into, written in place. only one producer may write at a time
+    SharedFrameSlot* begin() {
+        if(!header) return nullptr;
+
+        SharedFrameSlot& slot = header->slot[frame % SharedFrameHeader::SLOTS];
+        slot.seq.store((frame + 1) * 2 - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        return &slot;
+    }
+
+    // publishes the slot from begin()
+    void commit() {
+        if(!header) return;
+
+        SharedFrameSlot& slot = header->slot[frame % SharedFrameHeader::SLOTS];
+        frame++;
+
+        slot.timestamp = sharedFrameClock();
+        slot.seq.store(frame * 2, std::memory_order_release);
+        header->published.store(frame, std::memory_order_release);
+    }
+
+    // sleeps until the daemon has taken the last committed frame or timeoutMs passed, false on timeout
+    bool wait_consumed(long timeoutMs) {
+        if(!header) return false;
+
+        uint64_t deadline = sharedFrameClock() + timeoutMs * 1000000ULL;
+        while(header->consumed.load(std::memory_order_acquire) < frame) {
+            uint32_t wake = header->consumedWake.load(std::memory_order_acquire);
+            if(header->consumed.load(std::memory_order_acquire) >= frame) break;
+
+            uint64_t now = sharedFrameClock();
+            if(now >= deadline) return false;
+
+            struct timespec timeout = { (time_t)((deadline - now) / 1000000000ULL), (long)((deadline - now) % 1000000000ULL) };
+            syscall(SYS_futex, &header->consumedWake, FUTEX_WAIT, wake, &timeout, nullptr, 0);
+        }
+
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __RGBLIB_SUSPEND_HPP__
+#define __RGBLIB_SUSPEND_HPP__
+
+#include <time.h>
+
+// CLOCK_MONOTONIC stops while the system is suspended and CLOCK_BOOTTIME does not,
+// so the gap between them grows by the time spent asleep
+class SuspendDetector {
+private:
+    long long lastOffset;
+
+    static long long offset() {
+        struct timespec boot;
+        struct timespec monotonic;
+
+        clock_gettime(CLOCK_BOOTTIME, &boot);
+        clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+        return (boot.tv_sec - monotonic.tv_sec) * 1000000000LL + (boot.tv_nsec - monotonic.tv_nsec);
+    }
+
+public:
+    SuspendDetector() {
+        lastOffset = offset();
+    }
+
+    // true once for every suspend longer than thresholdMs since the last call
+    bool resumed(long long thresholdMs = 500) {
+        long long current = offset();
+        bool wasSuspended = current - lastOffset > thresholdMs * 1000000LL;
+
+        lastOffset = current;
+        return wasSuspended;
+    }
+};
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * an example effect plugin, a rainbow moving across the keyboard.
+ * param 0 is the speed in turns a second, 0.25 until it is set, and param 1 the width of one turn in mm, 200 until it is set.
+ * built next to waveeffect, copy rainbow.so into ~/.config/waveeffect/plugins and run "waveeffectctl effect rainbow"
+ */
+
+#include <RGBLib/util/effect_plugin.h>
+
+#include <math.h>
+
+static uint8_t channel(float hue) {
+    hue = fmodf(hue, 1.0f);
+    if(hue < 0.0f) hue += 1.0f;
+
+    float level = fabsf(hue * 6.0f - 3.0f) - 1.0f;
+    level = level < 0.0f ? 0.0f : level > 1.0f ? 1.0f : level;
+
+    return (uint8_t)(level * 255.0f);
+}
+
+static void render(void* state, const WaveEffectInput* input, WaveEffectRGB* out) {
+    (void)state;
+
+    float speed = input->paramCount > 0 && input->params[0] != 0.0f ? input->params[0] : 0.25f;
+    float width = input->paramCount > 1 && input->params[1] != 0.0f ? input->params[1] : 200.0f;
+
+    float shift = (float)fmod(input->time * speed, 1.0);
+    for(uint32_t led = 0; led < input->ledCount; led++) {
+        float hue = input->x[led] / width - shift;
+
+        out[led].red = channel(hue);
+        out[led].green = channel(hue - 1.0f / 3.0f);
+        out[led].blue = channel(hue + 1.0f / 3.0f);
+    }
+}
+
+static const WaveEffectPlugin plugin = { WAVEEFFECT_PLUGIN_ABI, 0, 0, render };
+
+const WaveEffectPlugin* waveeffect_plugin(void) {
+    return &plugin;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "wave.hpp"
+#include "expression.hpp"
+
+// bench_expression [expression]
+// times one frame of an expression against Wave::sampleRGB over a keyboard's worth of leds,
+// the best of a few runs each. run with meson test --benchmark, or straight from the build directory
+
+static const size_t ROWS = 6;
+static const size_t COLUMNS = 18;
+static const size_t LEDS = ROWS * COLUMNS;
+// the keyboard's wave is as long as its longest row
+static const size_t WAVE_ROWS = 22;
+
+static const size_t FRAMES = 20000;
+static const size_t RUNS = 7;
+
+static const char* DEFAULT_EXPRESSION = "hsv(240 + 44*tri(t*0.15 + x/22), 1 - keyheat, 1)";
+
+// microseconds a frame, the best of RUNS
+template<typename Render>
+static double bestOf(Render render) {
+    double best = 0;
+
+    for(size_t run = 0; run < RUNS; run++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(size_t frame = 0; frame < FRAMES; frame++) {
+            render(frame);
+        }
+
+        double took = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / FRAMES;
+        if(run == 0 || took < best) best = took;
+    }
+
+    return best;
+}
+
+int main(int argc, char** argv) {
+    std::string source = argc > 1 ? argv[1] : DEFAULT_EXPRESSION;
+
+    std::vector<KeyRect> keys;
+    for(size_t row = 0; row < ROWS; row++) {
+        for(size_t column = 0; column < COLUMNS; column++) {
+            keys.push_back({ (float)column, (float)row, 1.0f, 1.0f });
+        }
+    }
+
+    DeviceGeometry geometry(keys);
+
+    Expression expression;
+    std::string error;
+    if(!Expression::compile(source, expression, error)) {
+        printf("Failed to compile \"%s\": %s\n", source.c_str(), error.c_str());
+        return 1;
+    }
+
+    expression.bind(geometry);
+
+    Wave wave(WAVE_ROWS, { 240, 1, 1 }, { 284, 1, 1 }, 60, WaveDirection::WAVELEFT);
+
+    float positions[LEDS];
+    mapLEDsToWave(geometry, WAVE_ROWS, WAVESHAPE_LINEAR, 0.0f, positions, LEDS);
+
+    std::vector<uint8_t> keyheat(LEDS);
+    std::vector<RGB> out(LEDS);
+
+    // keeps the compiler from dropping the frames, and some heat so keyheat is not all zeros
+    unsigned int checksum = 0;
+    float params[Expression::PARAMS] = {};
+
+    double expressionTime = bestOf([&](size_t frame) -> void {
+        keyheat[frame % LEDS] = (uint8_t)frame;
+
+        expression.render(frame / 60.0, params, Expression::PARAMS, keyheat.data(), out.data());
+        checksum += out[frame % LEDS].red;
+    });
+
+    double waveTime = bestOf([&](size_t frame) -> void {
+        wave.sampleRGB(positions, out.data(), LEDS);
+        checksum += out[frame % LEDS].red;
+    });
+
+    printf("%zu leds, %zu frames, best of %zu runs\n", LEDS, FRAMES, RUNS);
+    printf("expression (%zu instructions) %s: %.2fus a frame\n", expression.getInstructionCount(), source.c_str(), expressionTime);
+    printf("Wave::sampleRGB: %.2fus a frame\n", waveTime);
+    printf("checksum %u\n", checksum);
+
+    return 0;
+}
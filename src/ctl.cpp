@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <RGBLib/util/control.hpp>
+
+#include <thread>
+#include <iostream>
+
+// waveeffectctl [command args; command args; ...]
+// sends its arguments as one batch, or without any every line of stdin as a batch of its own,
+// and prints the error of every batch that was turned down. exits with 1 if any was
+int main(int argc, char** argv) {
+    std::string path = controlSocketPath();
+
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        printf("Failed to connect to %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    std::string batch;
+    for(int i = 1; i < argc; i++) {
+        if(i > 1) batch += ' ';
+        batch += argv[i];
+    }
+
+    // lines are sent while the replies are read, so a long script never fills both directions at once
+    std::thread sender([fd, argc, batch]() -> void {
+        std::string line;
+        bool stdinLines = argc < 2;
+
+        while(stdinLines ? (bool)std::getline(std::cin, line) : !batch.empty()) {
+            if(!stdinLines) line = batch;
+            line += '\n';
+
+            for(size_t sent = 0; sent < line.size();) {
+                ssize_t wrote = send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+                if(wrote < 0 && errno == EINTR) continue;
+
+                if(wrote <= 0) {
+                    shutdown(fd, SHUT_WR);
+                    return;
+                }
+
+                sent += wrote;
+            }
+
+            if(!stdinLines) break;
+        }
+
+        shutdown(fd, SHUT_WR);
+    });
+
+    // only lines with a command get a reply
+    size_t batches = 0;
+    size_t errors = 0;
+
+    std::string replies;
+    char buffer[4096];
+
+    while(true) {
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) break;
+
+        replies.append(buffer, got);
+
+        size_t start = 0;
+        for(size_t end = replies.find('\n'); end != std::string::npos; end = replies.find('\n', start)) {
+            std::string reply = replies.substr(start, end - start);
+            start = end + 1;
+            batches++;
+
+            if(reply == "ok") continue;
+
+            errors++;
+            printf("batch %zu: %s\n", batches, reply.c_str());
+        }
+
+        replies.erase(0, start);
+    }
+
+    sender.join();
+    close(fd);
+
+    return errors > 0;
+}
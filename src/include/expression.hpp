@@ -0,0 +1,741 @@
+#ifndef __EXPRESSION_HPP__
+#define __EXPRESSION_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <math.h>
+
+#include "RGBLib/util/rgb.hpp"
+#include "RGBLib/util/hsv.hpp"
+#include "RGBLib/devices/geometry.hpp"
+
+// a small language for effects, one expression that gives every led its colour:
+//
+//     hsv(240 + 44 * tri(t * 0.15 + x / 22), 1, 1)
+//
+// t is seconds on the timeline the frame shows at, x and y the led's centre in keys from the top left,
+// led its index, keyheat 1 right after its key is pressed and back to 0 as it fades, p0 to p15 the effect params.
+// the operators are + - * / % ^, the functions sin cos (radians), tri saw (period 1), abs floor fract sqrt min max step clamp mix smoothstep.
+// the whole expression is hsv(h, s, v), h in degrees and s and v from 0 to 1, or rgb(r, g, b) from 0 to 1
+//
+// it is compiled once into register bytecode. whatever only depends on t and the params is worked out once a frame in double,
+// so t, sin(t) and t * 0.15 stay smooth after weeks of uptime. every other instruction runs in float over all the leds at once,
+// so interpreting it costs the same for one led or a whole keyboard. a uniform is only rounded to float where a per led value reads it,
+// so t * 0.15 + x / 22 does move in 1/64 steps once t * 0.15 is past 2^17, about 10 days in. anything of t alone, like tri(t * 0.15), stays smooth
+
+enum ExpressionOp : uint8_t {
+    EXPR_ADD = 0,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,
+    EXPR_MOD,
+    EXPR_POW,
+    EXPR_MIN,
+    EXPR_MAX,
+    EXPR_STEP,
+    EXPR_NEG,
+    EXPR_SIN,
+    EXPR_COS,
+    EXPR_TRI,
+    EXPR_SAW,
+    EXPR_ABS,
+    EXPR_FLOOR,
+    EXPR_FRACT,
+    EXPR_SQRT,
+    EXPR_CLAMP,
+    EXPR_MIX,
+    EXPR_SMOOTHSTEP,
+    // a uniform copied to every led
+    EXPR_BROADCAST
+};
+
+// dst = op(a, b, c). operands with UNIFORM set index the uniforms, the rest the per led registers
+struct ExpressionInstruction {
+    static constexpr uint16_t UNIFORM = 0x8000;
+
+    ExpressionOp op;
+    uint16_t dst;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+// every function for float, which the per led loops run in, and double, which the uniform program runs in
+struct ExpressionMath {
+    template<typename T> static T add(T a, T b) { return a + b; }
+    template<typename T> static T sub(T a, T b) { return a - b; }
+    template<typename T> static T mul(T a, T b) { return a * b; }
+    template<typename T> static T div(T a, T b) { return a / b; }
+    template<typename T> static T mod(T a, T b) { return a - b * floor(a / b); }
+    template<typename T> static T pow(T a, T b) { return std::pow(a, b); }
+    template<typename T> static T min(T a, T b) { return a < b ? a : b; }
+    template<typename T> static T max(T a, T b) { return a > b ? a : b; }
+    template<typename T> static T step(T edge, T v) { return v < edge ? T(0) : T(1); }
+
+    template<typename T> static T neg(T a) { return -a; }
+    template<typename T> static T sin(T a) { return std::sin(a); }
+    template<typename T> static T cos(T a) { return std::cos(a); }
+    template<typename T> static T fract(T a) { return a - floor(a); }
+    template<typename T> static T tri(T a) { return T(1) - std::fabs(T(2) * fract(a) - T(1)); }
+    template<typename T> static T abs(T a) { return std::fabs(a); }
+    // floorf through an int so the loops vectorize without sse4.1 or -fno-trapping-math.
+    // past 2^23 every float is whole already, it is bounded for the int and the part cut off added back.
+    // bounded with copysignf, a plain clamp would have gcc turn the conversion back into a branch
+    static float floor(float a) {
+        float bounded = copysignf(min(fabsf(a), 8388608.0f), a);
+
+        int whole = (int)bounded;
+        whole -= bounded < (float)whole;
+
+        return (float)whole + (a - bounded);
+    }
+    // the uniform program runs once a frame, nothing to vectorize
+    static double floor(double a) { return ::floor(a); }
+    template<typename T> static T sqrt(T a) { return std::sqrt(a); }
+
+    // degrees back into 0 to 360
+    static float hue(float a) { return a - 360.0f * floor(a * (1.0f / 360.0f)); }
+
+    template<typename T> static T clamp(T v, T low, T high) { return min(max(v, low), high); }
+    template<typename T> static T mix(T a, T b, T k) { return a + (b - a) * k; }
+
+    template<typename T> static T smoothstep(T low, T high, T v) {
+        T k = clamp((v - low) / (high - low), T(0), T(1));
+        return k * k * (T(3) - T(2) * k);
+    }
+};
+
+class Expression {
+public:
+    // uniforms before the constants and temporaries
+    static constexpr uint16_t UNIFORM_T = 0;
+    static constexpr uint16_t UNIFORM_PARAMS = 1;
+    static constexpr size_t PARAMS = 16;
+
+    // per led registers before the temporaries
+    static constexpr uint16_t VARYING_X = 0;
+    static constexpr uint16_t VARYING_Y = 1;
+    static constexpr uint16_t VARYING_LED = 2;
+    static constexpr uint16_t VARYING_KEYHEAT = 3;
+    static constexpr uint16_t VARYING_INPUTS = 4;
+
+    static constexpr size_t MAX_SOURCE = 4096;
+    static constexpr size_t MAX_DEPTH = 64;
+    static constexpr size_t MAX_REGISTERS = 1024;
+
+private:
+    std::string source;
+
+    // run once a frame on single doubles, then once a frame over every led
+    std::vector<ExpressionInstruction> uniformProgram;
+    std::vector<ExpressionInstruction> varyingProgram;
+
+    // double so t keeps its precision after days of uptime, rounded to float where the per led loops read them
+    std::vector<double> uniforms;
+    uint16_t varyingCount;
+
+    // the per led registers one after another, stride apart
+    std::vector<float> varying;
+    size_t ledCount;
+    size_t stride;
+
+    bool hsv;
+    uint16_t outputs[3];
+    bool usesKeyheat;
+
+    float* reg(uint16_t index) { return varying.data() + index * stride; }
+
+    template<float (*F)(float)>
+    void unary(const ExpressionInstruction& instruction) {
+        float* dst = reg(instruction.dst);
+        const float* a = reg(instruction.a);
+
+        for(size_t i = 0; i < ledCount; i++) {
+            dst[i] = F(a[i]);
+        }
+    }
+
+    // a uniform operand stays one float rather than being copied out to every led
+    template<float (*F)(float, float)>
+    void binary(const ExpressionInstruction& instruction) {
+        float* dst = reg(instruction.dst);
+
+        if(instruction.a & ExpressionInstruction::UNIFORM) {
+            float a = (float)uniforms[instruction.a & ~ExpressionInstruction::UNIFORM];
+            const float* b = reg(instruction.b);
+
+            for(size_t i = 0; i < ledCount; i++) {
+                dst[i] = F(a, b[i]);
+            }
+        }
+        else if(instruction.b & ExpressionInstruction::UNIFORM) {
+            const float* a = reg(instruction.a);
+            float b = (float)uniforms[instruction.b & ~ExpressionInstruction::UNIFORM];
+
+            for(size_t i = 0; i < ledCount; i++) {
+                dst[i] = F(a[i], b);
+            }
+        }
+        else {
+            const float* a = reg(instruction.a);
+            const float* b = reg(instruction.b);
+
+            for(size_t i = 0; i < ledCount; i++) {
+                dst[i] = F(a[i], b[i]);
+            }
+        }
+    }
+
+    // the compiler broadcasts uniform operands of these first
+    template<float (*F)(float, float, float)>
+    void ternary(const ExpressionInstruction& instruction) {
+        float* dst = reg(instruction.dst);
+        const float* a = reg(instruction.a);
+        const float* b = reg(instruction.b);
+        const float* c = reg(instruction.c);
+
+        for(size_t i = 0; i < ledCount; i++) {
+            dst[i] = F(a[i], b[i], c[i]);
+        }
+    }
+
+    void runVarying(const ExpressionInstruction& instruction) {
+        switch(instruction.op) {
+        case EXPR_ADD: binary<ExpressionMath::add<float>>(instruction); break;
+        case EXPR_SUB: binary<ExpressionMath::sub<float>>(instruction); break;
+        case EXPR_MUL: binary<ExpressionMath::mul<float>>(instruction); break;
+        case EXPR_DIV: binary<ExpressionMath::div<float>>(instruction); break;
+        case EXPR_MOD: binary<ExpressionMath::mod<float>>(instruction); break;
+        case EXPR_POW: binary<ExpressionMath::pow<float>>(instruction); break;
+        case EXPR_MIN: binary<ExpressionMath::min<float>>(instruction); break;
+        case EXPR_MAX: binary<ExpressionMath::max<float>>(instruction); break;
+        case EXPR_STEP: binary<ExpressionMath::step<float>>(instruction); break;
+        case EXPR_NEG: unary<ExpressionMath::neg<float>>(instruction); break;
+        case EXPR_SIN: unary<ExpressionMath::sin<float>>(instruction); break;
+        case EXPR_COS: unary<ExpressionMath::cos<float>>(instruction); break;
+        case EXPR_TRI: unary<ExpressionMath::tri<float>>(instruction); break;
+        case EXPR_SAW: unary<ExpressionMath::fract<float>>(instruction); break;
+        case EXPR_ABS: unary<ExpressionMath::abs<float>>(instruction); break;
+        case EXPR_FLOOR: unary<ExpressionMath::floor>(instruction); break;
+        case EXPR_FRACT: unary<ExpressionMath::fract<float>>(instruction); break;
+        case EXPR_SQRT: unary<ExpressionMath::sqrt<float>>(instruction); break;
+        case EXPR_CLAMP: ternary<ExpressionMath::clamp<float>>(instruction); break;
+        case EXPR_MIX: ternary<ExpressionMath::mix<float>>(instruction); break;
+        case EXPR_SMOOTHSTEP: ternary<ExpressionMath::smoothstep<float>>(instruction); break;
+        case EXPR_BROADCAST: {
+            float* dst = reg(instruction.dst);
+            std::fill(dst, dst + ledCount, (float)uniforms[instruction.a & ~ExpressionInstruction::UNIFORM]);
+
+            break;
+        }
+        }
+    }
+
+    static double runScalar(ExpressionOp op, double a, double b, double c) {
+        switch(op) {
+        case EXPR_ADD: return ExpressionMath::add<double>(a, b);
+        case EXPR_SUB: return ExpressionMath::sub<double>(a, b);
+        case EXPR_MUL: return ExpressionMath::mul<double>(a, b);
+        case EXPR_DIV: return ExpressionMath::div<double>(a, b);
+        case EXPR_MOD: return ExpressionMath::mod<double>(a, b);
+        case EXPR_POW: return ExpressionMath::pow<double>(a, b);
+        case EXPR_MIN: return ExpressionMath::min<double>(a, b);
+        case EXPR_MAX: return ExpressionMath::max<double>(a, b);
+        case EXPR_STEP: return ExpressionMath::step<double>(a, b);
+        case EXPR_NEG: return ExpressionMath::neg<double>(a);
+        case EXPR_SIN: return ExpressionMath::sin<double>(a);
+        case EXPR_COS: return ExpressionMath::cos<double>(a);
+        case EXPR_TRI: return ExpressionMath::tri<double>(a);
+        case EXPR_SAW: return ExpressionMath::fract<double>(a);
+        case EXPR_ABS: return ExpressionMath::abs<double>(a);
+        case EXPR_FLOOR: return ExpressionMath::floor(a);
+        case EXPR_FRACT: return ExpressionMath::fract<double>(a);
+        case EXPR_SQRT: return ExpressionMath::sqrt<double>(a);
+        case EXPR_CLAMP: return ExpressionMath::clamp<double>(a, b, c);
+        case EXPR_MIX: return ExpressionMath::mix<double>(a, b, c);
+        case EXPR_SMOOTHSTEP: return ExpressionMath::smoothstep<double>(a, b, c);
+        default: return a;
+        }
+    }
+
+    friend class ExpressionCompiler;
+
+public:
+    Expression() : varyingCount(VARYING_INPUTS), ledCount(0), stride(0), hsv(true), usesKeyheat(false) {}
+
+    static bool compile(const std::string& source, Expression& out, std::string& error);
+
+    const std::string& getSource() { return source; }
+    size_t getInstructionCount() { return uniformProgram.size() + varyingProgram.size(); }
+    // false if keyheat can be left null
+    bool needsKeyheat() { return usesKeyheat; }
+
+    // sets up the per led registers for the device's leds, allocates so it is done once before rendering
+    void bind(const DeviceGeometry& geometry) {
+        ledCount = geometry.getLEDCount();
+        // rounded up so every register starts aligned for the vector loops
+        stride = (ledCount + 7) & ~(size_t)7;
+
+        varying = std::vector<float>(varyingCount * stride);
+        for(size_t led = 0; led < ledCount; led++) {
+            reg(VARYING_X)[led] = geometry.getX(led) / DeviceGeometry::KEY_UNIT_MM;
+            reg(VARYING_Y)[led] = geometry.getY(led) / DeviceGeometry::KEY_UNIT_MM;
+            reg(VARYING_LED)[led] = (float)led;
+        }
+    }
+
+    size_t getLEDCount() { return ledCount; }
+
+    // every led's colour for the frame showing at time into out. keyheat is each led's 0 to 255 key intensity
+    void render(double time, const float* params, size_t paramCount, const uint8_t* keyheat, RGB* out) {
+        uniforms[UNIFORM_T] = time;
+        for(size_t i = 0; i < PARAMS; i++) {
+            uniforms[UNIFORM_PARAMS + i] = i < paramCount ? params[i] : 0.0f;
+        }
+
+        if(usesKeyheat) {
+            float* heat = reg(VARYING_KEYHEAT);
+            for(size_t led = 0; led < ledCount; led++) {
+                heat[led] = keyheat ? keyheat[led] * (1.0f / 255.0f) : 0.0f;
+            }
+        }
+
+        for(const ExpressionInstruction& instruction : uniformProgram) {
+            uniforms[instruction.dst] = runScalar(
+                instruction.op,
+                uniforms[instruction.a & ~ExpressionInstruction::UNIFORM],
+                uniforms[instruction.b & ~ExpressionInstruction::UNIFORM],
+                uniforms[instruction.c & ~ExpressionInstruction::UNIFORM]
+            );
+        }
+
+        for(const ExpressionInstruction& instruction : varyingProgram) {
+            runVarying(instruction);
+        }
+
+        float* first = reg(outputs[0]);
+        float* second = reg(outputs[1]);
+        float* third = reg(outputs[2]);
+
+        if(hsv) {
+            for(size_t i = 0; i < ledCount; i++) {
+                first[i] = ExpressionMath::hue(first[i]);
+            }
+        }
+
+        // nan fails every comparison, so it ends up 0 with whatever else is out of range
+        for(size_t i = 0; i < ledCount; i++) {
+            first[i] = ExpressionMath::clamp(first[i], 0.0f, hsv ? 360.0f : 1.0f);
+        }
+
+        for(size_t i = 0; i < ledCount; i++) {
+            second[i] = ExpressionMath::clamp(second[i], 0.0f, 1.0f);
+        }
+
+        for(size_t i = 0; i < ledCount; i++) {
+            third[i] = ExpressionMath::clamp(third[i], 0.0f, 1.0f);
+        }
+
+        if(hsv) {
+            HSVToRGBBatch(first, second, third, out, ledCount);
+            return;
+        }
+
+        for(size_t i = 0; i < ledCount; i++) {
+            out[i] = { (uint8_t)(first[i] * 255.0f), (uint8_t)(second[i] * 255.0f), (uint8_t)(third[i] * 255.0f) };
+        }
+    }
+};
+
+// recursive descent straight to bytecode. anything made of constants is folded,
+// anything made of uniforms goes to the uniform program, and per led temporaries are reused once read
+class ExpressionCompiler {
+private:
+    // what a parsed subexpression is, and where it is
+    struct Value {
+        enum Kind { CONSTANT, UNIFORM, VARYING } kind;
+
+        double constant;
+        uint16_t index = 0;
+        // a per led temporary that can be reused once it is read
+        bool temporary;
+    };
+
+    struct Function {
+        const char* name;
+        ExpressionOp op;
+        size_t args;
+    };
+
+    Expression& out;
+
+    const char* start;
+    const char* pos;
+    const char* end;
+    size_t depth;
+
+    std::vector<uint16_t> freeRegisters;
+    std::string error;
+
+    bool fail(const char* message) {
+        if(error.empty()) error = "col " + std::to_string(pos - start + 1) + ": " + message;
+        return false;
+    }
+
+    void skipWhitespace() {
+        while(pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n')) {
+            pos++;
+        }
+    }
+
+    bool accept(char c) {
+        skipWhitespace();
+        if(pos >= end || *pos != c) return false;
+
+        pos++;
+        return true;
+    }
+
+    bool expect(char c) {
+        if(accept(c)) return true;
+
+        char message[32];
+        snprintf(message, sizeof(message), "expected '%c'", c);
+
+        return fail(message);
+    }
+
+    static const Function* findFunction(const std::string& name) {
+        static const Function FUNCTIONS[] = {
+            { "sin", EXPR_SIN, 1 },
+            { "cos", EXPR_COS, 1 },
+            { "tri", EXPR_TRI, 1 },
+            { "saw", EXPR_SAW, 1 },
+            { "abs", EXPR_ABS, 1 },
+            { "floor", EXPR_FLOOR, 1 },
+            { "fract", EXPR_FRACT, 1 },
+            { "sqrt", EXPR_SQRT, 1 },
+            { "min", EXPR_MIN, 2 },
+            { "max", EXPR_MAX, 2 },
+            { "step", EXPR_STEP, 2 },
+            { "clamp", EXPR_CLAMP, 3 },
+            { "mix", EXPR_MIX, 3 },
+            { "smoothstep", EXPR_SMOOTHSTEP, 3 }
+        };
+
+        for(const Function& function : FUNCTIONS) {
+            if(name == function.name) return &function;
+        }
+
+        return nullptr;
+    }
+
+    bool uniform(double value, uint16_t& index) {
+        if(out.uniforms.size() >= Expression::MAX_REGISTERS) return fail("expression is too long");
+
+        index = (uint16_t)out.uniforms.size();
+        out.uniforms.push_back(value);
+
+        return true;
+    }
+
+    bool varying(uint16_t& index) {
+        if(!freeRegisters.empty()) {
+            index = freeRegisters.back();
+            freeRegisters.pop_back();
+
+            return true;
+        }
+
+        if(out.varyingCount >= Expression::MAX_REGISTERS) return fail("expression is too long");
+
+        index = out.varyingCount++;
+        return true;
+    }
+
+    void release(const Value& value) {
+        if(value.kind == Value::VARYING && value.temporary) freeRegisters.push_back(value.index);
+    }
+
+    // constants become uniforms once something that is not folded reads them
+    bool toUniform(Value& value) {
+        if(value.kind != Value::CONSTANT) return true;
+        if(!uniform(value.constant, value.index)) return false;
+
+        value.kind = Value::UNIFORM;
+        return true;
+    }
+
+    bool toVarying(Value& value) {
+        if(value.kind == Value::VARYING) return true;
+        if(!toUniform(value)) return false;
+
+        uint16_t index = 0;
+        if(!varying(index)) return false;
+
+        out.varyingProgram.push_back({ EXPR_BROADCAST, index, (uint16_t)(value.index | ExpressionInstruction::UNIFORM), 0, 0 });
+        value = { Value::VARYING, 0.0f, index, true };
+
+        return true;
+    }
+
+    bool emit(ExpressionOp op, Value* args, size_t count, Value& result) {
+        bool constant = true;
+        bool perLED = false;
+
+        for(size_t i = 0; i < count; i++) {
+            constant = constant && args[i].kind == Value::CONSTANT;
+            perLED = perLED || args[i].kind == Value::VARYING;
+        }
+
+        if(constant) {
+            result = { Value::CONSTANT, Expression::runScalar(op, args[0].constant, count > 1 ? args[1].constant : 0.0, count > 2 ? args[2].constant : 0.0), 0, false };
+            return true;
+        }
+
+        // dividing by a constant is a multiply, which the vector loops do far faster
+        if(op == EXPR_DIV && args[1].kind == Value::CONSTANT) {
+            op = EXPR_MUL;
+            args[1].constant = 1.0 / args[1].constant;
+        }
+
+        uint16_t operands[3] = { 0, 0, 0 };
+
+        if(!perLED) {
+            for(size_t i = 0; i < count; i++) {
+                if(!toUniform(args[i])) return false;
+                operands[i] = args[i].index | ExpressionInstruction::UNIFORM;
+            }
+
+            uint16_t index = 0;
+            if(!uniform(0.0f, index)) return false;
+
+            out.uniformProgram.push_back({ op, index, operands[0], operands[1], operands[2] });
+            result = { Value::UNIFORM, 0.0f, index, false };
+
+            return true;
+        }
+
+        // binary ops take one uniform side as it is, everything else reads per led registers
+        for(size_t i = 0; i < count; i++) {
+            if(count == 2 && args[i].kind != Value::VARYING) {
+                if(!toUniform(args[i])) return false;
+                operands[i] = args[i].index | ExpressionInstruction::UNIFORM;
+
+                continue;
+            }
+
+            if(!toVarying(args[i])) return false;
+            operands[i] = args[i].index;
+        }
+
+        // every led's operands are read before its result is written, so the result can take an operand's register
+        for(size_t i = 0; i < count; i++) {
+            release(args[i]);
+        }
+
+        uint16_t index = 0;
+        if(!varying(index)) return false;
+
+        out.varyingProgram.push_back({ op, index, operands[0], operands[1], operands[2] });
+        result = { Value::VARYING, 0.0f, index, true };
+
+        return true;
+    }
+
+    bool name(std::string& out) {
+        skipWhitespace();
+
+        const char* first = pos;
+        while(pos < end && (isalnum((unsigned char)*pos) || *pos == '_')) {
+            pos++;
+        }
+
+        out.assign(first, pos);
+        return !out.empty();
+    }
+
+    bool arguments(Value* args, size_t count) {
+        if(!expect('(')) return false;
+
+        for(size_t i = 0; i < count; i++) {
+            if(i > 0 && !expect(',')) return false;
+            if(!expression(args[i])) return false;
+        }
+
+        return expect(')');
+    }
+
+    bool atom(Value& result) {
+        skipWhitespace();
+        if(pos >= end) return fail("unexpected end");
+
+        if(accept('(')) {
+            return expression(result) && expect(')');
+        }
+
+        if(isdigit((unsigned char)*pos) || *pos == '.') {
+            std::string number;
+            while(pos < end && (isdigit((unsigned char)*pos) || *pos == '.' || *pos == 'e' || *pos == 'E' ||
+                ((*pos == '-' || *pos == '+') && (pos[-1] == 'e' || pos[-1] == 'E')))) {
+                number += *pos++;
+            }
+
+            char* numberEnd;
+            result = { Value::CONSTANT, strtod(number.c_str(), &numberEnd), 0, false };
+
+            if(*numberEnd != '\0') return fail("bad number");
+            return true;
+        }
+
+        const char* at = pos;
+
+        std::string word;
+        if(!name(word)) return fail("expected a number, name or '('");
+
+        if(word == "t") result = { Value::UNIFORM, 0.0f, Expression::UNIFORM_T, false };
+        else if(word == "x") result = { Value::VARYING, 0.0f, Expression::VARYING_X, false };
+        else if(word == "y") result = { Value::VARYING, 0.0f, Expression::VARYING_Y, false };
+        else if(word == "led") result = { Value::VARYING, 0.0f, Expression::VARYING_LED, false };
+        else if(word == "keyheat") {
+            result = { Value::VARYING, 0.0f, Expression::VARYING_KEYHEAT, false };
+            out.usesKeyheat = true;
+        }
+        else if(word == "pi") result = { Value::CONSTANT, M_PI, 0, false };
+        else if(word[0] == 'p' && word.size() >= 2 && word.size() <= 3 && word.find_first_not_of("0123456789", 1) == std::string::npos && atoi(word.c_str() + 1) < (int)Expression::PARAMS) {
+            result = { Value::UNIFORM, 0.0f, (uint16_t)(Expression::UNIFORM_PARAMS + atoi(word.c_str() + 1)), false };
+        }
+        else {
+            const Function* function = findFunction(word);
+            if(!function) {
+                pos = at;
+                return fail(("unknown name " + word.substr(0, 32)).c_str());
+            }
+
+            Value args[3];
+            return arguments(args, function->args) && emit(function->op, args, function->args, result);
+        }
+
+        return true;
+    }
+
+    // right associative, and binds tighter than a unary minus on its left
+    bool power(Value& result) {
+        if(!atom(result)) return false;
+        if(!accept('^')) return true;
+
+        Value args[2] = { result };
+        return unary(args[1]) && emit(EXPR_POW, args, 2, result);
+    }
+
+    bool unary(Value& result) {
+        if(++depth > Expression::MAX_DEPTH) return fail("nested too deep");
+
+        bool ok;
+        if(accept('-')) {
+            Value args[1];
+            ok = unary(args[0]) && emit(EXPR_NEG, args, 1, result);
+        }
+        else {
+            accept('+');
+            ok = power(result);
+        }
+
+        depth--;
+        return ok;
+    }
+
+    bool product(Value& result) {
+        if(!unary(result)) return false;
+
+        while(true) {
+            ExpressionOp op;
+            if(accept('*')) op = EXPR_MUL;
+            else if(accept('/')) op = EXPR_DIV;
+            else if(accept('%')) op = EXPR_MOD;
+            else return true;
+
+            Value args[2] = { result };
+            if(!unary(args[1]) || !emit(op, args, 2, result)) return false;
+        }
+    }
+
+    bool expression(Value& result) {
+        if(++depth > Expression::MAX_DEPTH) return fail("nested too deep");
+        if(!product(result)) return false;
+
+        while(true) {
+            ExpressionOp op;
+            if(accept('+')) op = EXPR_ADD;
+            else if(accept('-')) op = EXPR_SUB;
+            else break;
+
+            Value args[2] = { result };
+            if(!product(args[1]) || !emit(op, args, 2, result)) return false;
+        }
+
+        depth--;
+        return true;
+    }
+
+public:
+    ExpressionCompiler(Expression& out) : out(out), start(nullptr), pos(nullptr), end(nullptr), depth(0) {}
+
+    const std::string& getError() { return error; }
+
+    bool compile(const std::string& source) {
+        if(source.size() > Expression::MAX_SOURCE) return fail("expression is too long");
+
+        start = source.c_str();
+        pos = start;
+        end = start + source.size();
+
+        out.source = source;
+        out.uniforms = std::vector<double>(Expression::UNIFORM_PARAMS + Expression::PARAMS);
+
+        std::string word;
+        if(!name(word) || (word != "hsv" && word != "rgb")) return fail("has to be hsv(h, s, v) or rgb(r, g, b)");
+
+        out.hsv = word == "hsv";
+
+        Value args[3];
+        if(!arguments(args, 3)) return false;
+
+        skipWhitespace();
+        if(pos != end) return fail("unexpected text after the expression");
+
+        // the colours are clamped in place, so an input like x is copied to a register of its own first
+        for(size_t i = 0; i < 3; i++) {
+            if(args[i].kind == Value::VARYING && !args[i].temporary) {
+                Value copy[2] = { args[i], { Value::CONSTANT, 0.0f, 0, false } };
+                if(!emit(EXPR_ADD, copy, 2, args[i])) return false;
+            }
+
+            if(!toVarying(args[i])) return false;
+            out.outputs[i] = args[i].index;
+        }
+
+        return true;
+    }
+};
+
+inline bool Expression::compile(const std::string& source, Expression& out, std::string& error) {
+    out = Expression();
+
+    ExpressionCompiler compiler(out);
+    if(compiler.compile(source)) return true;
+
+    error = compiler.getError();
+    return false;
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef __RIPPLE_HPP__
+#define __RIPPLE_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include "RGBLib/util/rgb.hpp"
+#include "RGBLib/devices/geometry.hpp"
+
+struct RippleConfig {
+    RGB color = { 255, 255, 255 };
+
+    // mm per second the ring grows
+    float speed = 200.0f;
+    // mm from the ring's centre line to where it fades out
+    float width = 20.0f;
+    // seconds until a ripple is gone
+    float lifetime = 1.0f;
+};
+
+// expanding rings from pressed keys, evaluated against the geometry's distance tables.
+// ripples live in a fixed pool so spawning never allocates, a full pool replaces its oldest ripple
+class RippleEngine {
+public:
+    static const size_t CAPACITY = 32;
+
+private:
+    const DeviceGeometry& geometry;
+    RippleConfig config;
+
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point epoch;
+
+    // pool, structure of arrays. start times are double seconds since epoch,
+    // a float would be down to 1/64s steps after a few days of uptime
+    uint8_t origins[CAPACITY];
+    double startTimes[CAPACITY];
+    size_t active;
+
+    std::vector<float> intensity;
+
+    double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+public:
+    RippleEngine(const DeviceGeometry& geometry, RippleConfig config = RippleConfig()) : geometry(geometry), config(config) {
+        this->epoch = std::chrono::steady_clock::now();
+        this->active = 0;
+
+        this->intensity = std::vector<float>(geometry.getLEDCount());
+    }
+
+    // safe to call from input threads
+    void spawn(uint8_t led) {
+        if(led >= geometry.getLEDCount()) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        size_t slot = active;
+        if(active == CAPACITY) {
+            slot = std::min_element(startTimes, startTimes + active) - startTimes;
+        }
+        else {
+            active++;
+        }
+
+        origins[slot] = led;
+        startTimes[slot] = now();
+    }
+
+    bool isActive() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return active > 0;
+    }
+
+    // adds the rings onto leds, saturating. O(leds * active ripples)
+    void render(RGB* leds, size_t count) {
+        count = std::min(count, geometry.getLEDCount());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        double time = now();
+
+        // drop finished ripples by moving the last one into their slot
+        for(size_t i = 0; i < active;) {
+            if(time - startTimes[i] < config.lifetime) {
+                i++;
+                continue;
+            }
+
+            active--;
+            origins[i] = origins[active];
+            startTimes[i] = startTimes[active];
+        }
+
+        if(active == 0) return;
+
+        std::fill(intensity.begin(), intensity.begin() + count, 0.0f);
+
+        const float scale = 1.0f / DeviceGeometry::GEOMETRY_SCALE;
+        const float inverseWidth = 1.0f / config.width;
+
+        float* acc = intensity.data();
+        for(size_t ripple = 0; ripple < active; ripple++) {
+            // small once subtracted, so float keeps the per led loop vectorized
+            float age = (float)(time - startTimes[ripple]);
+
+            float radius = age * config.speed;
+            float fade = 1.0f - age / config.lifetime;
+
+            const uint16_t* distances = geometry.distanceRow(origins[ripple]);
+            for(size_t led = 0; led < count; led++) {
+                float ring = 1.0f - fabsf(distances[led] * scale - radius) * inverseWidth;
+
+                // max(ring, 0) without a branch so the loop vectorizes
+                acc[led] += 0.5f * (ring + fabsf(ring)) * fade;
+            }
+        }
+
+        for(size_t led = 0; led < count; led++) {
+            float amount = std::min(acc[led], 1.0f);
+
+            leds[led].red = (uint8_t)std::min(leds[led].red + config.color.red * amount, 255.0f);
+            leds[led].green = (uint8_t)std::min(leds[led].green + config.color.green * amount, 255.0f);
+            leds[led].blue = (uint8_t)std::min(leds[led].blue + config.color.blue * amount, 255.0f);
+        }
+    }
+};
+
+#endif
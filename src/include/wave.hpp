@@ -1,165 +1,430 @@
-#ifndef __WAVE_HPP__
-#define __WAVE_HPP__
-
-#include <chrono>
-#include <stdint.h>
-#include "RGBLib/util/rgb.hpp"
-#include "RGBLib/util/hsv.hpp"
-
-#include <thread>
-
-enum WaveDirection {
-    WAVELEFT = 0,
-    WAVERIGHT
-};
-
-class WaveRow {
-private:
-    HSV maxHSV;
-    HSV minHSV;
-
-    HSV currentHSV;
-    WaveDirection waveDirection;
-    WaveDirection direction;
-public:
-    WaveRow(HSV currentHSV, HSV minHSV, HSV maxHSV, WaveDirection direction) {
-        this->currentHSV = currentHSV;
-        this->minHSV = minHSV;
-        this->maxHSV = maxHSV;
-
-        this->waveDirection = direction;
-        this->direction = direction;
-    }
-
-    void update(HSV shiftAmount) {
-        currentHSV.H += shiftAmount.H * (direction != waveDirection ? -4 : 1);
-        currentHSV.S += shiftAmount.S * (direction != waveDirection ? -4 : 1);
-        currentHSV.V += shiftAmount.V * (direction != waveDirection ? -4 : 1);
-
-        if(currentHSV.H > maxHSV.H) {
-            currentHSV = maxHSV;
-            direction = WaveDirection::WAVERIGHT;
-        }
-        else if(currentHSV.H < minHSV.H) {
-            currentHSV = minHSV;
-            direction = WaveDirection::WAVELEFT;
-        }
-    }
-
-    HSV getHSV() {
-        return this->currentHSV;
-    }
-
-};
-
-class Wave {
-private:
-    WaveRow* rows;
-    size_t rowsLen;
-
-    double refreshRate;
-    WaveDirection direction;
-
-    bool runUpdaterThread;
-    std::thread updaterThread;
-
-    HSV maxHSV;
-    HSV minHSV;
-
-    void init() {
-        HSV rowHSV = minHSV;
-
-        HSV addHSV = {
-            (maxHSV.H - minHSV.H) / rowsLen,
-            (maxHSV.S - minHSV.S) / rowsLen,
-            (maxHSV.V - minHSV.V) / rowsLen
-        };
-
-        for(
-            size_t i = 0; i < rowsLen;
-                rowHSV.H += addHSV.H,
-                rowHSV.S += addHSV.S,
-                rowHSV.V += addHSV.V,
-                i++) {
-            rows[i] = WaveRow(rowHSV, minHSV, maxHSV, this->direction);
-        }
-    }
-
-public:
-    Wave(size_t numRows, HSV minHSV, HSV maxHSV, unsigned int refreshRate, WaveDirection direction) {
-        this->rowsLen = numRows;
-        this->rows = (WaveRow*)calloc(rowsLen, sizeof(WaveRow));
-
-        this->refreshRate = refreshRate;
-        this->direction = direction;
-
-        this->minHSV = minHSV;
-        this->maxHSV = maxHSV;
-
-        init();
-
-        this->runUpdaterThread = false;
-    }
-
-
-    void stopUpdaterThread() {
-        if(!runUpdaterThread) return;
-
-        runUpdaterThread = false;
-        updaterThread.join();
-    }
-
-    void startUpdaterThread(const double shiftAmount) {
-        if(runUpdaterThread) return;
-
-        runUpdaterThread = true;
-        updaterThread = std::thread([this, shiftAmount]() -> void {
-            HSV addHSV = {
-                (((maxHSV.H - minHSV.H) / rowsLen) * shiftAmount) * (direction == WaveDirection::WAVELEFT ? 1 : -1),
-                (((maxHSV.S - minHSV.S) / rowsLen) * shiftAmount) * (direction == WaveDirection::WAVELEFT ? 1 : -1),
-                (((maxHSV.V - minHSV.V) / rowsLen) * shiftAmount) * (direction == WaveDirection::WAVELEFT ? 1 : -1)
-            };
-
-            while (runUpdaterThread) {
-                for(size_t i = 0; i < rowsLen; i++) {
-                    rows[i].update(addHSV);
-                }
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds((int)(1000 / refreshRate)));
-            }
-        });
-    }
-
-    bool updaterThreadRunning() {
-        return this->runUpdaterThread;
-    }
-
-
-    ~Wave() {
-        stopUpdaterThread();
-
-        free(rows);
-    }
-
-
-    RGB getRGB(int row) {
-        return HSVToRGB(rows[row].getHSV());
-    }
-
-    void update(double shiftAmount) {
-        HSV addHSV = {
-            ((maxHSV.H - minHSV.H) / rowsLen) * shiftAmount,
-            ((maxHSV.S - minHSV.S) / rowsLen) * shiftAmount,
-            ((maxHSV.V - minHSV.V) / rowsLen) * shiftAmount
-        };
-
-        for(size_t i = 0; i < rowsLen; i++) {
-            rows[i].update(addHSV);
-        }
-    }
-
-
-    size_t getRowsLen() { return this->rowsLen; }
-};
-
-#endif
+#ifndef __WAVE_HPP__
+#define __WAVE_HPP__
+
+#include <chrono>
+#include <stdint.h>
+#include "RGBLib/util/rgb.hpp"
+#include "RGBLib/util/hsv.hpp"
+#include "RGBLib/devices/geometry.hpp"
+#include "RGBLib/util/activity.hpp"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <math.h>
+
+enum WaveDirection {
+    WAVELEFT = 0,
+    WAVERIGHT
+};
+
+enum WaveShape {
+    // left to right, tilted by rowOffset mm across per mm down
+    WAVESHAPE_LINEAR = 0,
+    // outwards from the centre of the device
+    WAVESHAPE_RADIAL
+};
+
+class WaveRow {
+private:
+    HSV maxHSV;
+    HSV minHSV;
+
+    HSV currentHSV;
+    WaveDirection waveDirection;
+    WaveDirection direction;
+public:
+    WaveRow(HSV currentHSV, HSV minHSV, HSV maxHSV, WaveDirection direction) {
+        this->currentHSV = currentHSV;
+        this->minHSV = minHSV;
+        this->maxHSV = maxHSV;
+
+        this->waveDirection = direction;
+        this->direction = direction;
+    }
+
+    void update(HSV shiftAmount) {
+        currentHSV.H += shiftAmount.H * (direction != waveDirection ? -4 : 1);
+        currentHSV.S += shiftAmount.S * (direction != waveDirection ? -4 : 1);
+        currentHSV.V += shiftAmount.V * (direction != waveDirection ? -4 : 1);
+
+        if(currentHSV.H > maxHSV.H) {
+            currentHSV = maxHSV;
+            direction = WaveDirection::WAVERIGHT;
+        }
+        else if(currentHSV.H < minHSV.H) {
+            currentHSV = minHSV;
+            direction = WaveDirection::WAVELEFT;
+        }
+    }
+
+    HSV getHSV() {
+        return this->currentHSV;
+    }
+
+    bool operator==(const WaveRow& other) const {
+        return
+            currentHSV.H == other.currentHSV.H &&
+            currentHSV.S == other.currentHSV.S &&
+            currentHSV.V == other.currentHSV.V &&
+            direction == other.direction;
+    }
+};
+
+class Wave {
+private:
+    WaveRow* rows;
+    size_t rowsLen;
+
+    double refreshRate;
+    WaveDirection direction;
+
+    bool runUpdaterThread;
+    std::thread updaterThread;
+
+    // set by startUpdaterThread
+    double shiftAmount;
+    // updates the updater thread has made
+    std::atomic<uint64_t> steps;
+
+    // the updater waits on it while idle, see startUpdaterThread
+    ActivityGovernor* governor;
+
+    // set once findCycle finds it, lets the updater skip whole cycles it slept through
+    std::atomic<size_t> cycleStart;
+    std::atomic<size_t> cycleLength;
+
+    // update n is due at startTime + n * period, so the step at any time is known ahead
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::duration period;
+
+    HSV maxHSV;
+    HSV minHSV;
+
+    // per row hsv gathered for sampling
+    std::vector<float> rowH;
+    std::vector<float> rowS;
+    std::vector<float> rowV;
+
+    void init(WaveRow* rows) {
+        HSV rowHSV = minHSV;
+
+        HSV addHSV = {
+            (maxHSV.H - minHSV.H) / rowsLen,
+            (maxHSV.S - minHSV.S) / rowsLen,
+            (maxHSV.V - minHSV.V) / rowsLen
+        };
+
+        for(
+            size_t i = 0; i < rowsLen;
+                rowHSV.H += addHSV.H,
+                rowHSV.S += addHSV.S,
+                rowHSV.V += addHSV.V,
+                i++) {
+            rows[i] = WaveRow(rowHSV, minHSV, maxHSV, this->direction);
+        }
+    }
+
+    // what the updater thread adds every update
+    HSV stepHSV(double shiftAmount) {
+        return {
+            (((maxHSV.H - minHSV.H) / rowsLen) * shiftAmount) * (direction == WaveDirection::WAVELEFT ? 1 : -1),
+            (((maxHSV.S - minHSV.S) / rowsLen) * shiftAmount) * (direction == WaveDirection::WAVELEFT ? 1 : -1),
+            (((maxHSV.V - minHSV.V) / rowsLen) * shiftAmount) * (direction == WaveDirection::WAVELEFT ? 1 : -1)
+        };
+    }
+
+    static void step(std::vector<WaveRow>& state, HSV addHSV) {
+        for(WaveRow& row : state) {
+            row.update(addHSV);
+        }
+    }
+
+    // brings the rows up to the updates due by now after the updater slept, so getStepAt still holds.
+    // once the wave is in its cycle the whole cycles missed change nothing and are only counted
+    void catchUp(HSV addHSV) {
+        uint64_t due = getStepAt(std::chrono::steady_clock::now());
+        // findCycle sets the start first
+        size_t length = cycleLength;
+        size_t start = cycleStart;
+
+        // only the cycle's users need the rows to match the step, without one the wave carries on from where it stopped
+        if(length == 0) {
+            steps = std::max<uint64_t>(steps, due);
+            return;
+        }
+
+        while(steps < due) {
+            if(steps >= start) {
+                steps += (due - steps) / length * length;
+                if(steps == due) break;
+            }
+
+            for(size_t i = 0; i < rowsLen; i++) {
+                rows[i].update(addHSV);
+            }
+
+            steps++;
+        }
+    }
+
+public:
+    Wave(size_t numRows, HSV minHSV, HSV maxHSV, unsigned int refreshRate, WaveDirection direction) {
+        this->rowsLen = numRows;
+        this->rows = (WaveRow*)calloc(rowsLen, sizeof(WaveRow));
+
+        this->refreshRate = refreshRate;
+        this->direction = direction;
+
+        this->minHSV = minHSV;
+        this->maxHSV = maxHSV;
+
+        this->rowH = std::vector<float>(rowsLen);
+        this->rowS = std::vector<float>(rowsLen);
+        this->rowV = std::vector<float>(rowsLen);
+
+        init(rows);
+
+        this->runUpdaterThread = false;
+        this->shiftAmount = 0;
+        this->steps = 0;
+
+        this->governor = nullptr;
+        this->cycleStart = 0;
+        this->cycleLength = 0;
+
+        this->startTime = std::chrono::steady_clock::now();
+        this->period = std::chrono::milliseconds((int)(1000 / refreshRate));
+    }
+
+
+    void stopUpdaterThread() {
+        if(!runUpdaterThread) return;
+
+        runUpdaterThread = false;
+        if(governor) governor->wake();
+
+        updaterThread.join();
+    }
+
+    // with a governor the updater sleeps while it is idle and catches up when it wakes
+    void startUpdaterThread(const double shiftAmount, ActivityGovernor* governor = nullptr) {
+        if(runUpdaterThread) return;
+
+        runUpdaterThread = true;
+        this->shiftAmount = shiftAmount;
+        this->governor = governor;
+        this->startTime = std::chrono::steady_clock::now();
+
+        updaterThread = std::thread([this, shiftAmount]() -> void {
+            HSV addHSV = stepHSV(shiftAmount);
+
+            // updates run on deadlines, a late one is caught up rather than pushing the rest back
+            std::chrono::steady_clock::time_point deadline = startTime;
+            while (runUpdaterThread) {
+                if(this->governor && this->governor->state() == ACTIVITY_IDLE) {
+                    this->governor->wait_active([this]() -> bool { return !runUpdaterThread; });
+                    if(!runUpdaterThread) break;
+
+                    catchUp(addHSV);
+
+                    deadline = startTime + period * steps.load();
+                    std::this_thread::sleep_until(deadline);
+
+                    continue;
+                }
+
+                for(size_t i = 0; i < rowsLen; i++) {
+                    rows[i].update(addHSV);
+                }
+
+                steps++;
+
+                deadline += period;
+                std::this_thread::sleep_until(deadline);
+            }
+        });
+    }
+
+    bool updaterThreadRunning() {
+        return this->runUpdaterThread;
+    }
+
+
+    ~Wave() {
+        stopUpdaterThread();
+
+        free(rows);
+    }
+
+
+    RGB getRGB(int row) {
+        return HSVToRGB(rows[row].getHSV());
+    }
+
+    void update(double shiftAmount) {
+        HSV addHSV = {
+            ((maxHSV.H - minHSV.H) / rowsLen) * shiftAmount,
+            ((maxHSV.S - minHSV.S) / rowsLen) * shiftAmount,
+            ((maxHSV.V - minHSV.V) / rowsLen) * shiftAmount
+        };
+
+        for(size_t i = 0; i < rowsLen; i++) {
+            rows[i].update(addHSV);
+        }
+    }
+
+
+    size_t getRowsLen() { return this->rowsLen; }
+    // updates per second
+    double getRefreshRate() { return this->refreshRate; }
+
+    // updates made by the updater thread since it started
+    uint64_t getStep() { return this->steps; }
+
+    // updates the updater thread will have made by time, also in the future
+    uint64_t getStepAt(std::chrono::steady_clock::time_point time) {
+        if(time <= startTime) return 0;
+        return (uint64_t)((time - startTime) / period) + 1;
+    }
+
+    // updates per second the updater thread actually makes
+    double getStepRate() {
+        return 1.0 / std::chrono::duration<double>(period).count();
+    }
+
+    // the updater thread's wave repeats every length updates once it has made start updates.
+    // found by replaying it from the start with brent's cycle detection, false if it takes over maxSteps
+    bool findCycle(size_t maxSteps, size_t& start, size_t& length) {
+        HSV addHSV = stepHSV(shiftAmount);
+
+        std::vector<WaveRow> initial(rowsLen, WaveRow(minHSV, minHSV, maxHSV, direction));
+        init(initial.data());
+
+        std::vector<WaveRow> tortoise = initial;
+        std::vector<WaveRow> hare = initial;
+        step(hare, addHSV);
+
+        size_t power = 1;
+        length = 1;
+        for(size_t taken = 0; tortoise != hare; taken++) {
+            if(taken >= maxSteps) return false;
+
+            if(power == length) {
+                tortoise = hare;
+                power *= 2;
+                length = 0;
+            }
+
+            step(hare, addHSV);
+            length++;
+        }
+
+        tortoise = initial;
+        hare = initial;
+        for(size_t i = 0; i < length; i++) {
+            step(hare, addHSV);
+        }
+
+        for(start = 0; tortoise != hare; start++) {
+            step(tortoise, addHSV);
+            step(hare, addHSV);
+        }
+
+        cycleStart = start;
+        cycleLength = length;
+
+        return true;
+    }
+
+    // colours of every row after start + update updates for each of the length updates, out[update * rowsLen + row]
+    void getCycleRGB(size_t start, size_t length, RGB* out) {
+        HSV addHSV = stepHSV(shiftAmount);
+
+        std::vector<WaveRow> state(rowsLen, WaveRow(minHSV, minHSV, maxHSV, direction));
+        init(state.data());
+
+        for(size_t i = 0; i < start; i++) {
+            step(state, addHSV);
+        }
+
+        for(size_t update = 0; update < length; update++) {
+            for(size_t row = 0; row < rowsLen; row++) {
+                out[update * rowsLen + row] = HSVToRGB(state[row].getHSV());
+            }
+
+            step(state, addHSV);
+        }
+    }
+
+    // colour at fractional rows, interpolated between the two nearest rows
+    void sampleRGB(const float* positions, RGB* out, size_t count) {
+        const size_t CHUNK = 64;
+
+        for(size_t i = 0; i < rowsLen; i++) {
+            HSV hsv = rows[i].getHSV();
+
+            rowH[i] = hsv.H;
+            rowS[i] = hsv.S;
+            rowV[i] = hsv.V;
+        }
+
+        float h[CHUNK];
+        float s[CHUNK];
+        float v[CHUNK];
+
+        const float last = (float)(rowsLen - 1);
+        for(size_t start = 0; start < count; start += CHUNK) {
+            size_t chunkLen = std::min(CHUNK, count - start);
+
+            for(size_t i = 0; i < chunkLen; i++) {
+                float position = std::clamp(positions[start + i], 0.0f, last);
+
+                size_t low = (size_t)position;
+                size_t high = std::min(low + 1, rowsLen - 1);
+                float t = position - (float)low;
+
+                h[i] = rowH[low] + (rowH[high] - rowH[low]) * t;
+                s[i] = rowS[low] + (rowS[high] - rowS[low]) * t;
+                v[i] = rowV[low] + (rowV[high] - rowV[low]) * t;
+            }
+
+            HSVToRGBBatch(h, s, v, out + start, chunkLen);
+        }
+    }
+};
+
+// fills positions[led] with the fractional wave row of every led from the device geometry.
+// positions are scaled so the whole device spans the wave once
+static void mapLEDsToWave(const DeviceGeometry& geometry, size_t rowsLen, WaveShape shape, float rowOffset, float* positions, size_t ledCount) {
+    size_t count = std::min(ledCount, geometry.getLEDCount());
+
+    const uint16_t* x = geometry.xTable();
+    const uint16_t* y = geometry.yTable();
+    const uint16_t* centreDistances = geometry.centreDistanceTable();
+
+    for(size_t led = 0; led < ledCount; led++) {
+        positions[led] = 0.0f;
+    }
+
+    for(size_t led = 0; led < count; led++) {
+        switch(shape) {
+        case WAVESHAPE_RADIAL: positions[led] = centreDistances[led]; break;
+        default: positions[led] = x[led] + y[led] * rowOffset; break;
+        }
+    }
+
+    if(count == 0) return;
+
+    float minPosition = *std::min_element(positions, positions + count);
+    float maxPosition = *std::max_element(positions, positions + count);
+    if(maxPosition <= minPosition) return;
+
+    float scale = (rowsLen - 1) / (maxPosition - minPosition);
+    for(size_t led = 0; led < count; led++) {
+        positions[led] = (positions[led] - minPosition) * scale;
+    }
+}
+
+#endif
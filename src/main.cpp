@@ -1,128 +1,1118 @@
-#include <cstring>
-#include <stdio.h>
-#include <RGBLib/devices/Keychron/KeychronV6.hpp>
-
-#include <signal.h>
-
-#include <math.h>
-
-#include "wave.hpp"
-#include "virt_utils.hpp"
-
-
-static Wave* wave;
-
-void keyboardWaveUpdater(KeychronV6* keyboard) {
-    keyboard->set_effect();
-
-    size_t frame = 0;
-    while(wave->updaterThreadRunning()) {
-        // set around every 5 seconds
-        if(frame % (30 * 5) == 0) {
-            keyboard->set_effect();
-        }
-
-        for(size_t col = 0; col < keyboard->getCols(); col++) {
-            keyboard->set_col(col, wave->getRGB(col));
-        }
-
-        keyboard->draw_frame();
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000/15));
-        frame++;
-    }
-}
-
-void onSIGINT(int) {
-    printf("SIGINT RECEIVED! SHUTTING DOWN...\n");
-
-    wave->stopUpdaterThread();
-}
-
-void cleanup(KeychronV6* keyboard, std::thread* keyboardWaveUpdaterThread, std::thread* virtCheckerThread) {
-    signal(SIGINT, onSIGINT);
-
-    keyboardWaveUpdaterThread->join();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-    for(std::pair<const uint8_t, RGB> pair : keyboard->get_custom_leds()) {
-        keyboard->unset_custom_led(pair.first);
-    }
-
-    keyboard->draw_frame();
-
-    virtCheckerThread->join();
-
-    delete keyboard;
-    delete wave;
-
-    hid_exit();
-}
-
-int main() {
-    signal(SIGINT, onSIGINT);
-
-    KeychronV6* keyboard = new KeychronV6();
-
-    size_t maxKeyboardRows = 0;
-    for(size_t i = 0; i < keyboard->leds.size(); i++) {
-        if(keyboard->leds[i].size() > maxKeyboardRows) {
-            maxKeyboardRows = keyboard->leds[i].size();
-        }
-    }
-
-    wave = new Wave(maxKeyboardRows, {240, 1, 1}, {284, 1, 1}, 60, WaveDirection::WAVELEFT);
-    wave->startUpdaterThread(0.15);
-
-    std::thread keyboardWaveUpdaterThread(keyboardWaveUpdater, keyboard);
-    std::thread virtCheckerThread([](KeychronV6* keyboard) -> void {
-        const char* TARGET_VM_NAME = "windows";
-
-        VirtConnection con = VirtConnection("qemu:///system");
-        bool firstWithoutDomain = true;
-        
-        while(wave->updaterThreadRunning()) {
-            if(!VirtUtils::hasVM(con, TARGET_VM_NAME)) {
-                if(firstWithoutDomain) {
-                    printf("windows vm not found.\n");
-                    firstWithoutDomain = false;
-                    
-                    keyboard->unset_custom_led(14);
-                }
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds(10000));
-                continue;
-            }
-
-            firstWithoutDomain = true;
-            bool isOn = VirtUtils::VirtualMachineOn(con, TARGET_VM_NAME);
-
-            if(keyboard->keypressStartTimes.find(KEY_RIGHTALT) != keyboard->keypressStartTimes.end()) {
-                if(time(NULL) - keyboard->keypressStartTimes[KEY_RIGHTALT] > 3) {
-                    VirtUtils::toggleVM(con, TARGET_VM_NAME);
-
-                    // stop vm from being toggled until a repress
-                    auto it = keyboard->keypressStartTimes.find(KEY_RIGHTALT);
-                    // stop race condition
-                    if(it != keyboard->keypressStartTimes.end()) {
-                        keyboard->keypressStartTimes.erase(it);
-                    }
-                }
-            }
-
-            if(isOn) {
-                keyboard->unset_custom_led(14);
-            }
-            else {
-                keyboard->set_custom_led(14, { 69, 3, 1 });
-            }
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-            firstWithoutDomain = true;
-        }
-    }, keyboard);
-
-    cleanup(keyboard, &keyboardWaveUpdaterThread, &virtCheckerThread);
-
-    return 0;
-}
+#include <cstring>
+#include <stdio.h>
+#include <RGBLib/devices/Keychron/KeychronV6.hpp>
+#include <RGBLib/devices/SteelSeries/Rival600.hpp>
+#include <RGBLib/devices/scheduler.hpp>
+#include <RGBLib/devices/canvas.hpp>
+#include <RGBLib/util/shared_frames.hpp>
+#include <RGBLib/util/frame_mirror.hpp>
+#include <RGBLib/util/control.hpp>
+#include <RGBLib/util/effect_plugins.hpp>
+#include <RGBLib/util/activity.hpp>
+
+#include <signal.h>
+
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+
+#include <math.h>
+
+#include "wave.hpp"
+#include "ripple.hpp"
+#include "virt_utils.hpp"
+#include "expression.hpp"
+
+
+static Wave* wave;
+static CanvasBuffer* canvas;
+static RenderScheduler* scheduler;
+static FrameMirror* mirror;
+static EffectPluginHost* plugins;
+static ActivityGovernor* governor;
+
+// one cycle of the wave's row colours, empty if it was not found
+struct WaveCycle {
+    size_t start = 0;
+    size_t length = 0;
+
+    // [phase * rowsLen + row]
+    std::vector<RGB> colors;
+};
+
+static WaveCycle waveCycle;
+static volatile sig_atomic_t printLinkHealth = 0;
+static std::atomic<bool> running(true);
+
+// what the wave is made with, changed by the control socket
+struct WaveConfig {
+    HSV from = { 240, 1, 1 };
+    HSV to = { 284, 1, 1 };
+
+    // updates per second, and rows the colours move each update
+    unsigned int rate = 60;
+    double shift = 0.15;
+};
+
+static WaveConfig waveConfig;
+
+// the vm held right alt starts and stops
+static std::mutex vmMutex;
+static std::string vmName = "windows";
+
+// the plugin or expression drawing the keyboard instead of the wave, neither while both are empty.
+// only touched under the keyboard renderer's frame lock, or by the main thread while nothing renders
+static const size_t EFFECT_PARAMS = Expression::PARAMS;
+static std::string effectName;
+static std::shared_ptr<Expression> effectExpression;
+static float effectParams[EFFECT_PARAMS];
+
+// the wave's update at a time on the scheduler's timeline
+uint64_t waveStepAt(double time) {
+    return wave->getStepAt(scheduler->at(time));
+}
+
+void printSharedFrames(const char* name, SharedFrameRing* ring) {
+    LinkHealthSnapshot latency = ring->get_latency();
+
+    printf(
+        "%s: %zu shared frames shown, %zu too old, write to submit p50 %uus p90 %uus p99 %uus max %uus\n",
+        name, ring->get_frames(), ring->get_stale(), latency.p50, latency.p90, latency.p99, latency.max
+    );
+}
+
+void printDeviceHealth(const char* name, Device* device) {
+    LinkHealthSnapshot health = device->get_link_health();
+
+    printf("%s: report gap %lldus, %zu write errors\n", name, (long long)device->get_report_gap().count(), device->get_report_errors());
+    printf("%s: %zu probes, %zu timeouts, rtt p50 %uus p90 %uus p99 %uus max %uus\n", name, health.probes, health.timeouts, health.p50, health.p90, health.p99, health.max);
+
+    printf("%s: rtt histogram", name);
+    for(size_t i = 0; i < LinkHealthSnapshot::BUCKETS; i++) {
+        printf(" %zu", health.histogram[i]);
+    }
+
+    printf("\n");
+}
+
+// WAVESHAPE_LINEAR without a row offset is drawn per column, anything else per led
+static const WaveShape KEYBOARD_WAVE_SHAPE = WAVESHAPE_LINEAR;
+static const float KEYBOARD_WAVE_ROW_OFFSET = 0.0f;
+
+// the column wave repeats, one cycle of it is encoded once and replayed
+static const size_t WAVE_CYCLE_MAX_STEPS = 100000;
+static const size_t KEYBOARD_FRAME_CACHE_BYTES = 256 * 1024;
+
+static const double KEYBOARD_FPS = 15.0;
+// every zone is a feature report, which are slow
+static const double MOUSE_FPS = 5.0;
+
+// the mouse runs the wave's cycle as an on-board gradient, restarted this often to stay in phase with its own clock
+static const bool MOUSE_GRADIENTS = true;
+static const double MOUSE_PHASE_CORRECTION_SECONDS = 30.0;
+
+// the desk both devices sit on, the mouse to the right of the keyboard
+static const size_t CANVAS_WIDTH = 128;
+static const size_t CANVAS_HEIGHT = 32;
+static const float MOUSE_GAP_MM = 50.0f;
+static const CanvasSampling CANVAS_SAMPLING = SAMPLING_AREA;
+
+// the keyboard draws its wave natively so the column cache works, this samples the canvas per led instead
+static const bool KEYBOARD_FROM_CANVAS = false;
+
+// other processes draw over the keyboard's effects through this ring in /dev/shm, see shared_frames.hpp.
+// a frame older than the max age when it is taken is dropped, and a producer that stops for the hold time is cleared
+static const char* KEYBOARD_SHARED_FRAMES = "/waveeffect-keychron-v6";
+static const uint64_t SHARED_FRAME_MAX_AGE_NS = 100 * 1000000ULL;
+static const double SHARED_FRAME_HOLD_SECONDS = 1.0;
+
+// every device's last frame is mirrored read only to /dev/shm for overlays and other drivers, see frame_mirror.hpp.
+// the keyboard's frames show every key pressed, so only this user can read it unless other users are let in here
+static const char* FRAME_MIRROR = "/waveeffect-mirror";
+static const bool FRAME_MIRROR_OTHER_USERS = false;
+
+// effect plugins are loaded from effectPluginDirectory(), see effect_plugin.h.
+// a plugin taking longer than the budget for a few frames in a row is left out until it is reloaded
+static const std::chrono::microseconds EFFECT_PLUGIN_BUDGET(2000);
+
+// without input from either device for the idle time everything fades out over the fade time and stops until the next one,
+// "idle seconds" on the control socket changes it and 0 never idles. on battery no device draws faster than BATTERY_FPS
+static const double IDLE_SECONDS = 600.0;
+static const double IDLE_FADE_SECONDS = 3.0;
+static const double BATTERY_FPS = 5.0;
+
+// makes the wave from waveConfig and finds its cycle, the old one has to be gone
+void startWave(size_t rows) {
+    wave = new Wave(rows, waveConfig.from, waveConfig.to, waveConfig.rate, WaveDirection::WAVELEFT);
+    wave->startUpdaterThread(waveConfig.shift, governor);
+
+    waveCycle = WaveCycle();
+    if(wave->findCycle(WAVE_CYCLE_MAX_STEPS, waveCycle.start, waveCycle.length)) {
+        waveCycle.colors = std::vector<RGB>(waveCycle.length * wave->getRowsLen());
+        wave->getCycleRGB(waveCycle.start, waveCycle.length, waveCycle.colors.data());
+    }
+}
+
+enum ControlOp {
+    // led [rrggbb...], custom colours from led on
+    CONTROL_LEDS = 0,
+    // unset led [count]
+    CONTROL_UNSET_LEDS,
+    // layer name opacity
+    CONTROL_LAYER,
+    // colors h s v h s v, the two ends of the wave
+    CONTROL_COLORS,
+    // speed updates shift, updates per second and rows moved per update
+    CONTROL_SPEED,
+    // fps keyboard|mouse|canvas fps
+    CONTROL_FPS,
+    // vm name
+    CONTROL_VM,
+    // effect name|wave, the plugin drawing the keyboard
+    CONTROL_EFFECT,
+    // param index value, passed to the plugin or expression
+    CONTROL_PARAM,
+    // expr hsv(...)|rgb(...), see expression.hpp
+    CONTROL_EXPRESSION,
+    // idle seconds, 0 never idles
+    CONTROL_IDLE
+};
+
+// one command from the control socket, checked and parsed on the socket's thread
+struct Control {
+    ControlOp op;
+
+    uint8_t led;
+    std::vector<RGB> colors;
+    size_t count;
+
+    KeychronV6Layer layer;
+    uint8_t opacity;
+
+    HSV from;
+    HSV to;
+    unsigned int rate;
+    double shift;
+
+    double fps;
+    std::string name;
+
+    size_t param;
+    float value;
+
+    double seconds;
+
+    // compiled on the socket's thread, bound to the keyboard when applied
+    std::shared_ptr<Expression> expression;
+};
+
+typedef ControlServer<Control> Controls;
+static Controls* controls;
+
+// wakes the main thread to apply batches as they come in, it takes them every 100ms either way
+static std::mutex controlMutex;
+static std::condition_variable controlCondition;
+static bool controlsQueued = false;
+
+bool parseNumber(const std::string& word, double low, double high, double& out) {
+    char* end;
+    out = strtod(word.c_str(), &end);
+
+    return *end == '\0' && out >= low && out <= high;
+}
+
+bool parseColor(const std::string& word, RGB& out) {
+    if(word.size() != 6 || word.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) return false;
+
+    unsigned long rgb = strtoul(word.c_str(), nullptr, 16);
+    out = { (uint8_t)(rgb >> 16), (uint8_t)(rgb >> 8), (uint8_t)rgb };
+
+    return true;
+}
+
+bool parseControl(const std::vector<std::string>& words, Control& out, std::string& error) {
+    const std::string& command = words[0];
+    size_t args = words.size() - 1;
+
+    double number;
+    if(command == "led" || command == "unset") {
+        if(args < 1 || !parseNumber(words[1], 0, KeychronV6TotalLEDs - 1, number) || number != floor(number)) {
+            error = "needs an led from 0 to " + std::to_string(KeychronV6TotalLEDs - 1);
+            return false;
+        }
+
+        out.led = (uint8_t)number;
+
+        if(command == "unset") {
+            out.op = CONTROL_UNSET_LEDS;
+            out.count = 1;
+
+            if(args > 2 || (args == 2 && (!parseNumber(words[2], 1, KeychronV6TotalLEDs - out.led, number) || number != floor(number)))) {
+                error = "count has to be from 1 to the last led";
+                return false;
+            }
+
+            if(args == 2) out.count = (size_t)number;
+            return true;
+        }
+
+        out.op = CONTROL_LEDS;
+        if(args < 2 || out.led + args - 1 > KeychronV6TotalLEDs) {
+            error = "needs 1 to " + std::to_string(KeychronV6TotalLEDs - out.led) + " colours";
+            return false;
+        }
+
+        out.colors = std::vector<RGB>(args - 1);
+        for(size_t i = 0; i < out.colors.size(); i++) {
+            if(parseColor(words[i + 2], out.colors[i])) continue;
+
+            error = words[i + 2] + " is not an rrggbb colour";
+            return false;
+        }
+
+        return true;
+    }
+
+    if(command == "layer") {
+        static const char* LAYERS[KEYCHRON_LAYER_COUNT] = { "cols", "keys", "external", "overlay", "decay", "custom" };
+
+        if(args != 2 || !parseNumber(words[2], 0, 255, number)) {
+            error = "needs a layer and an opacity from 0 to 255";
+            return false;
+        }
+
+        out.op = CONTROL_LAYER;
+        out.opacity = (uint8_t)number;
+
+        for(size_t layer = 0; layer < KEYCHRON_LAYER_COUNT; layer++) {
+            if(words[1] != LAYERS[layer]) continue;
+
+            out.layer = (KeychronV6Layer)layer;
+            return true;
+        }
+
+        error = "no layer " + words[1] + ", the layers are cols keys external overlay decay custom";
+        return false;
+    }
+
+    if(command == "colors") {
+        double hsv[6];
+        for(size_t i = 0; i < 6; i++) {
+            if(args == 6 && parseNumber(words[i + 1], 0, i % 3 == 0 ? 360 : 1, hsv[i])) continue;
+
+            error = "needs two colours as h s v, h from 0 to 360 and s and v from 0 to 1";
+            return false;
+        }
+
+        out.op = CONTROL_COLORS;
+        out.from = { hsv[0], hsv[1], hsv[2] };
+        out.to = { hsv[3], hsv[4], hsv[5] };
+
+        // the wave moves from the lower hue to the higher one
+        if(out.to.H < out.from.H) std::swap(out.from, out.to);
+
+        return true;
+    }
+
+    if(command == "speed") {
+        if(args != 2 || !parseNumber(words[1], 1, 1000, number) || !parseNumber(words[2], 0.001, 100, out.shift)) {
+            error = "needs 1 to 1000 updates per second and a shift from 0.001 to 100 rows";
+            return false;
+        }
+
+        out.op = CONTROL_SPEED;
+        out.rate = (unsigned int)number;
+
+        return true;
+    }
+
+    if(command == "fps") {
+        out.op = CONTROL_FPS;
+
+        if(args == 2 && words[1] == "keyboard") out.name = "Keychron V6";
+        else if(args == 2 && words[1] == "mouse") out.name = "Rival 600";
+        else if(args == 2 && words[1] == "canvas") out.name = "Canvas";
+
+        if(out.name.empty() || !parseNumber(words[2], 0.1, 1000, out.fps)) {
+            error = "needs keyboard, mouse or canvas and 0.1 to 1000 fps";
+            return false;
+        }
+
+        return true;
+    }
+
+    if(command == "vm") {
+        if(args != 1) {
+            error = "needs the name of a vm";
+            return false;
+        }
+
+        out.op = CONTROL_VM;
+        out.name = words[1];
+
+        return true;
+    }
+
+    if(command == "effect") {
+        if(args != 1) {
+            error = "needs the name of a plugin, or wave";
+            return false;
+        }
+
+        out.op = CONTROL_EFFECT;
+        out.name = words[1] == "wave" ? "" : words[1];
+
+        return true;
+    }
+
+    if(command == "param") {
+        double value;
+        if(args != 2 || !parseNumber(words[1], 0, EFFECT_PARAMS - 1, number) || number != floor(number) || !parseNumber(words[2], -1e9, 1e9, value)) {
+            error = "needs an index from 0 to " + std::to_string(EFFECT_PARAMS - 1) + " and a value";
+            return false;
+        }
+
+        out.op = CONTROL_PARAM;
+        out.param = (size_t)number;
+        out.value = (float)value;
+
+        return true;
+    }
+
+    if(command == "expr") {
+        // the words are put back together, spaces mean nothing to the expression
+        std::string source;
+        for(size_t i = 1; i < words.size(); i++) {
+            source += words[i] + " ";
+        }
+
+        out.op = CONTROL_EXPRESSION;
+        out.expression = std::make_shared<Expression>();
+
+        return Expression::compile(source, *out.expression, error);
+    }
+
+    if(command == "idle") {
+        if(args != 1 || !parseNumber(words[1], 0, 86400, out.seconds)) {
+            error = "needs 0 to 86400 seconds, 0 never idles";
+            return false;
+        }
+
+        out.op = CONTROL_IDLE;
+        return true;
+    }
+
+    error = "unknown command, the commands are led unset layer colors speed fps vm effect param expr idle";
+    return false;
+}
+
+// the wave's colours and speed need every device stopped
+bool controlRestarts(const Controls::Batch& batch) {
+    for(const Control& control : batch) {
+        if(control.op == CONTROL_COLORS || control.op == CONTROL_SPEED) return true;
+    }
+
+    return false;
+}
+
+// what the keyboard draws with is only changed between its frames, see KeyboardRenderer::queue
+bool controlNeedsKeyboard(const Controls::Batch& batch) {
+    for(const Control& control : batch) {
+        switch(control.op) {
+        case CONTROL_LEDS:
+        case CONTROL_UNSET_LEDS:
+        case CONTROL_LAYER:
+        case CONTROL_EFFECT:
+        case CONTROL_PARAM:
+        case CONTROL_EXPRESSION:
+            return true;
+        default: break;
+        }
+    }
+
+    return false;
+}
+
+// the keyboard's commands between its frames, the rest on the main thread, and anything while nothing renders
+void applyControl(const Control& control, KeychronV6* keyboard) {
+    switch(control.op) {
+    case CONTROL_LEDS:
+        for(size_t i = 0; i < control.colors.size(); i++) {
+            keyboard->set_custom_led(control.led + i, control.colors[i]);
+        }
+
+        break;
+    case CONTROL_UNSET_LEDS:
+        for(size_t i = 0; i < control.count; i++) {
+            keyboard->unset_custom_led(control.led + i);
+        }
+
+        break;
+    case CONTROL_LAYER: keyboard->get_layer(control.layer).opacity = control.opacity; break;
+    case CONTROL_COLORS:
+        waveConfig.from = control.from;
+        waveConfig.to = control.to;
+
+        break;
+    case CONTROL_SPEED:
+        waveConfig.rate = control.rate;
+        waveConfig.shift = control.shift;
+
+        break;
+    case CONTROL_FPS: scheduler->set_fps(control.name, control.fps); break;
+    case CONTROL_VM: {
+        std::lock_guard<std::mutex> lock(vmMutex);
+        vmName = control.name;
+
+        break;
+    }
+    case CONTROL_EFFECT:
+        effectName = control.name;
+        effectExpression.reset();
+
+        break;
+    case CONTROL_PARAM: effectParams[control.param] = control.value; break;
+    case CONTROL_EXPRESSION:
+        control.expression->bind(keyboard->get_geometry());
+
+        effectName.clear();
+        effectExpression = control.expression;
+
+        break;
+    case CONTROL_IDLE: governor->set_idle(control.seconds); break;
+    }
+}
+
+
+// the keyboard's columns span the wave like mapLEDsToWave, past the last column it keeps the last row
+class CanvasRenderer {
+private:
+    std::vector<float> positions;
+    std::vector<RGB> colors;
+
+    // led centres of the keyboard's first and last columns
+    float first;
+    float last;
+
+public:
+    CanvasRenderer(const DeviceGeometry& keyboardGeometry) {
+        const Canvas& layout = canvas->getLayout();
+
+        positions = std::vector<float>(layout.getWidth());
+        colors = std::vector<RGB>(layout.getWidth());
+
+        first = keyboardGeometry.getX(0);
+        last = first;
+        for(size_t led = 0; led < keyboardGeometry.getLEDCount(); led++) {
+            first = std::min(first, keyboardGeometry.getX(led));
+            last = std::max(last, keyboardGeometry.getX(led));
+        }
+
+        float pixelMM = layout.getWidthMM() / layout.getWidth();
+        for(size_t x = 0; x < layout.getWidth(); x++) {
+            positions[x] = getPosition((x + 0.5f) * pixelMM);
+        }
+    }
+
+    // fractional wave row at x mm across the canvas
+    float getPosition(float x) {
+        return (x - first) / (last - first) * (wave->getRowsLen() - 1);
+    }
+
+    void render(double) {
+        Canvas& back = canvas->getBack();
+
+        wave->sampleRGB(positions.data(), colors.data(), back.getWidth());
+        for(size_t y = 0; y < back.getHeight(); y++) {
+            for(size_t x = 0; x < back.getWidth(); x++) {
+                back.set(x, y, colors[x]);
+            }
+        }
+
+        canvas->publish();
+    }
+};
+
+class KeyboardRenderer {
+private:
+    KeychronV6* keyboard;
+    RippleEngine* ripples;
+    const CanvasSampler* sampler;
+
+    size_t mirrorIndex;
+
+    SharedFrameRing* sharedFrames;
+    SharedFrameSlot sharedFrame;
+    // when the shown shared frame was published, 0 once its latency is recorded
+    uint64_t sharedTimestamp;
+    double lastShared;
+
+    bool perLED;
+
+    float positions[KeychronV6TotalLEDs];
+    RGB colors[KeychronV6TotalLEDs];
+    RGB effectColors[KeychronV6TotalLEDs];
+    uint8_t keyHeat[KeychronV6TotalLEDs];
+    RGB rippleColors[KeychronV6TotalLEDs];
+
+    bool cached;
+
+    // held for a whole frame, so a batch goes in before or after one and shows whole
+    std::mutex frameMutex;
+    // queued by the main thread for the next frame
+    std::vector<Controls::Batch> batches;
+
+    // with frameMutex held
+    void applyBatches() {
+        for(const Controls::Batch& batch : batches) {
+            for(const Control& control : batch) {
+                applyControl(control, keyboard);
+            }
+        }
+
+        batches.clear();
+    }
+
+public:
+    KeyboardRenderer(KeychronV6* keyboard, RippleEngine* ripples, const CanvasSampler* sampler, SharedFrameRing* sharedFrames) :
+        keyboard(keyboard), ripples(ripples), sampler(sampler), sharedFrames(sharedFrames) {
+        mirrorIndex = mirror->add("Keychron V6", KeychronV6TotalLEDs);
+
+        sharedTimestamp = 0;
+        lastShared = 0;
+
+        setupWave();
+    }
+
+    ~KeyboardRenderer() {
+        // the cache renders from waveCycle
+        keyboard->clear_frame_cache();
+    }
+
+    // from the main thread, a batch that changes what the keyboard draws goes in before its next frame.
+    // a keyboard that is gone has no frames coming, so it is applied straight away instead of piling up
+    void queue(Controls::Batch&& batch) {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        batches.push_back(std::move(batch));
+
+        if(!keyboard->is_connected()) applyBatches();
+    }
+
+    // applies whatever is queued, for the main thread while nothing renders
+    void flush() {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        applyBatches();
+    }
+
+    // after the wave is remade, with nothing rendering
+    void setupWave() {
+        perLED = KEYBOARD_FROM_CANVAS || KEYBOARD_WAVE_SHAPE != WAVESHAPE_LINEAR || KEYBOARD_WAVE_ROW_OFFSET != 0.0f;
+
+        mapLEDsToWave(keyboard->get_geometry(), wave->getRowsLen(), KEYBOARD_WAVE_SHAPE, KEYBOARD_WAVE_ROW_OFFSET, positions, KeychronV6TotalLEDs);
+
+        cached = !perLED && waveCycle.length > 0;
+
+        if(cached) {
+            size_t rowsLen = wave->getRowsLen();
+
+            keyboard->set_frame_cache(waveCycle.length, [rowsLen](size_t phase, RGB* cols) -> void {
+                for(size_t col = 0; col < KeychronV6Cols; col++) {
+                    cols[col] = col < rowsLen ? waveCycle.colors[phase * rowsLen + col] : RGB { 0x00, 0x00, 0x00 };
+                }
+            }, KEYBOARD_FRAME_CACHE_BYTES);
+        }
+        else {
+            keyboard->clear_frame_cache();
+        }
+    }
+
+    // time is when the frame will show, the cached columns are picked for then. false if it was not sent
+    bool render(double time) {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        applyBatches();
+
+        // fading out once idle
+        keyboard->set_brightness((uint8_t)lroundf(governor->brightness() * 255.0f));
+
+        // plugins reloaded since the last frame take over from here
+        plugins->swap();
+        bool effect = !effectName.empty() && plugins->render(effectName, time, effectParams, EFFECT_PARAMS, effectColors);
+
+        if(effectExpression) {
+            if(effectExpression->needsKeyheat()) keyboard->get_key_heat(keyHeat);
+
+            effectExpression->render(time, effectParams, EFFECT_PARAMS, keyHeat, effectColors);
+            effect = true;
+        }
+
+        uint64_t step = waveStepAt(time);
+        bool cached = this->cached && !effect && step >= waveCycle.start;
+
+        if(effect) {
+            for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+                keyboard->set_frame_led(led, effectColors[led]);
+            }
+        }
+        else if(perLED) {
+            if(KEYBOARD_FROM_CANVAS) canvas->sample(*sampler, colors, KeychronV6TotalLEDs);
+            else wave->sampleRGB(positions, colors, KeychronV6TotalLEDs);
+
+            for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+                keyboard->set_frame_led(led, colors[led]);
+            }
+        }
+        else if(!cached) {
+            for(size_t col = 0; col < keyboard->getCols(); col++) {
+                keyboard->set_col(col, wave->getRGB(col));
+            }
+        }
+
+        // ripples are added over the wave by the keyboard's overlay layer
+        if(ripples->isActive()) {
+            KeychronV6::LEDFrame& overlay = keyboard->get_layer(KEYCHRON_LAYER_OVERLAY).frame;
+
+            std::fill(rippleColors, rippleColors + KeychronV6TotalLEDs, RGB { 0x00, 0x00, 0x00 });
+            ripples->render(rippleColors, KeychronV6TotalLEDs);
+
+            for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+                overlay.set(led, rippleColors[led]);
+            }
+        }
+
+        // the newest shared frame replaces the effects where its mask is set
+        KeychronV6::LEDFrame& external = keyboard->get_layer(KEYCHRON_LAYER_EXTERNAL).frame;
+        if(sharedFrames->take(sharedFrame, SHARED_FRAME_MAX_AGE_NS)) {
+            external.clear();
+            for(uint8_t led = 0; led < KeychronV6TotalLEDs; led++) {
+                if(sharedFrame.mask[led / 64] & (1ULL << (led % 64))) external.set(led, sharedFrame.colors[led]);
+            }
+
+            sharedTimestamp = sharedFrame.timestamp;
+            lastShared = time;
+        }
+        else if(time - lastShared > SHARED_FRAME_HOLD_SECONDS) {
+            external.clear();
+        }
+
+        bool sent = cached ? keyboard->draw_cached_frame((step - waveCycle.start) % waveCycle.length) : keyboard->draw_frame();
+
+        // only frames that were sent change what the keyboard shows, the probe thread writes reports too
+        if(sent) {
+            const std::vector<KeychronV6Report>& reports = keyboard->get_sent_reports();
+
+            mirror->publish(
+                mirrorIndex, keyboard->get_shown_frame().colors, KeychronV6TotalLEDs,
+                (const uint8_t*)reports.data(), reports.size() * sizeof(KeychronV6Report)
+            );
+        }
+
+        // a shared frame that did not go out is still in the external layer for the next one
+        if(sent && sharedTimestamp) {
+            sharedFrames->submitted(sharedTimestamp);
+            sharedTimestamp = 0;
+        }
+
+        return sent;
+    }
+};
+
+// the wave is periodic, so the mouse can run each zone's colours over one cycle as an on-board gradient
+// and only hear from the host when it drifts. anything else is sampled from the canvas every frame
+class MouseRenderer {
+private:
+    Rival600* mouse;
+    const CanvasSampler* sampler;
+
+    // the wave row under each zone
+    size_t rows[Rival600TotalLEDs];
+
+    size_t mirrorIndex;
+
+    // what set_leds last got the mouse to show, zones are only sent when they change
+    RGB shown[Rival600TotalLEDs];
+    bool shownValid;
+
+    bool gradients;
+    double lastUpload;
+
+    void upload(double time) {
+        size_t rowsLen = wave->getRowsLen();
+
+        // the last stop closes the loop back to the first colour
+        const size_t stops = Rival600MaxGradientStops - 1;
+        uint16_t durationMs = (uint16_t)std::min(waveCycle.length * 1000.0 / wave->getStepRate(), 65535.0);
+
+        for(uint8_t led = 0; led < Rival600TotalLEDs; led++) {
+            GradientStop gradient[Rival600MaxGradientStops];
+
+            // each zone's gradient starts when its report is in, one report after this one
+            double shown = scheduler->now() + mouse->get_report_write_time().count() / 1e6;
+            size_t phase = (waveStepAt(shown) - waveCycle.start) % waveCycle.length;
+
+            for(size_t stop = 0; stop <= stops; stop++) {
+                size_t stopPhase = (phase + stop * waveCycle.length / stops) % waveCycle.length;
+
+                gradient[stop].color = waveCycle.colors[stopPhase * rowsLen + rows[led]];
+                gradient[stop].position = (float)stop / stops;
+            }
+
+            mouse->set_gradient(led, gradient, stops + 1, durationMs, true, true);
+        }
+
+        lastUpload = time;
+    }
+
+public:
+    MouseRenderer(Rival600* mouse, const CanvasSampler* sampler, CanvasRenderer* canvasRenderer, float mouseX) : mouse(mouse), sampler(sampler) {
+        const DeviceGeometry& geometry = mouse->get_geometry();
+
+        for(uint8_t led = 0; led < Rival600TotalLEDs; led++) {
+            float position = canvasRenderer->getPosition(mouseX + geometry.getX(led));
+            rows[led] = (size_t)std::clamp(lroundf(position), 0L, (long)wave->getRowsLen() - 1);
+        }
+
+        setupWave();
+
+        shownValid = false;
+        mirrorIndex = mirror->add("Rival 600", Rival600TotalLEDs);
+    }
+
+    // after the wave is remade, with nothing rendering. the gradients are uploaded again on the next frame
+    void setupWave() {
+        gradients = MOUSE_GRADIENTS && waveCycle.length > 0;
+        lastUpload = -MOUSE_PHASE_CORRECTION_SECONDS;
+    }
+
+    // the mirror gets the colours the zones show, the gradients' reports are only sent every few seconds so none are mirrored.
+    // true if the mouse was sent this frame, which with gradients is only when they were uploaded
+    bool render(double time) {
+        RGB colors[Rival600TotalLEDs];
+
+        // the gradients can not be dimmed, fading out is drawn from the canvas
+        float brightness = governor->brightness();
+
+        uint64_t step = waveStepAt(time);
+        if(gradients && brightness == 1.0f && step >= waveCycle.start) {
+            bool uploaded = false;
+            if(!mouse->has_gradients() || time - lastUpload >= MOUSE_PHASE_CORRECTION_SECONDS) {
+                upload(time);
+                uploaded = true;
+            }
+
+            size_t phase = (step - waveCycle.start) % waveCycle.length;
+            for(uint8_t led = 0; led < Rival600TotalLEDs; led++) {
+                colors[led] = waveCycle.colors[phase * wave->getRowsLen() + rows[led]];
+            }
+
+            // gone or reconnected since, the mouse is not running them
+            shownValid = false;
+            if(!mouse->has_gradients()) return false;
+
+            mirror->publish(mirrorIndex, colors, Rival600TotalLEDs, nullptr, 0);
+            return uploaded;
+        }
+
+        canvas->sample(*sampler, colors, Rival600TotalLEDs);
+
+        if(brightness < 1.0f) {
+            uint8_t level = (uint8_t)lroundf(brightness * 255.0f);
+
+            for(RGB& rgb : colors) {
+                rgb.red = (rgb.red * level + 255) >> 8;
+                rgb.green = (rgb.green * level + 255) >> 8;
+                rgb.blue = (rgb.blue * level + 255) >> 8;
+            }
+        }
+
+        if(!mouse->set_leds(colors, Rival600TotalLEDs)) {
+            shownValid = false;
+            return false;
+        }
+
+        mirror->publish(mirrorIndex, colors, Rival600TotalLEDs, nullptr, 0);
+
+        // nothing went out if no zone changed
+        bool changed = !shownValid || memcmp(shown, colors, sizeof(shown)) != 0;
+        std::copy(colors, colors + Rival600TotalLEDs, shown);
+        shownValid = true;
+
+        return changed;
+    }
+};
+
+void onSIGINT(int) {
+    printf("SIGINT RECEIVED! SHUTTING DOWN...\n");
+
+    running = false;
+}
+
+void onSIGUSR1(int) {
+    printLinkHealth = 1;
+}
+
+// applies batches that change the wave between two frames of every device, then remakes the wave from waveConfig
+void restartEffects(std::vector<Controls::Batch>& batches, KeychronV6* keyboard, KeyboardRenderer* keyboardRenderer, MouseRenderer* mouseRenderer) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    scheduler->stop();
+
+    // batches before these that the keyboard has not drawn yet
+    keyboardRenderer->flush();
+
+    for(Controls::Batch& batch : batches) {
+        for(const Control& control : batch) {
+            applyControl(control, keyboard);
+        }
+    }
+
+    size_t rows = wave->getRowsLen();
+    delete wave;
+
+    startWave(rows);
+    keyboardRenderer->setupWave();
+    mouseRenderer->setupWave();
+
+    scheduler->start();
+
+    long long took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("Wave changed, %zu cycle steps, restarted in %lldus\n", waveCycle.length, took);
+}
+
+// batches from the control socket in the order they came, on the main thread so they apply whether or not the keyboard is there.
+// one that changes the wave needs every device stopped, it and every batch after it are applied in one restart
+void applyControls(std::vector<Controls::Batch>& batches, KeychronV6* keyboard, KeyboardRenderer* keyboardRenderer, MouseRenderer* mouseRenderer) {
+    for(size_t i = 0; i < batches.size(); i++) {
+        if(controlRestarts(batches[i])) {
+            std::vector<Controls::Batch> restart(std::make_move_iterator(batches.begin() + i), std::make_move_iterator(batches.end()));
+            restartEffects(restart, keyboard, keyboardRenderer, mouseRenderer);
+
+            break;
+        }
+
+        if(controlNeedsKeyboard(batches[i])) {
+            keyboardRenderer->queue(std::move(batches[i]));
+            continue;
+        }
+
+        for(const Control& control : batches[i]) {
+            applyControl(control, keyboard);
+        }
+    }
+
+    batches.clear();
+}
+
+void cleanup(KeychronV6* keyboard, Rival600* mouse, RippleEngine* ripples, KeyboardRenderer* keyboardRenderer, SharedFrameRing* sharedFrames, std::thread* virtCheckerThread) {
+    signal(SIGINT, onSIGINT);
+
+    scheduler->stop();
+    delete controls;
+    delete plugins;
+    delete keyboardRenderer;
+    delete sharedFrames;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    keyboard->clear_custom_leds();
+
+    keyboard->draw_frame();
+
+    virtCheckerThread->join();
+
+    // the keyboard's input threads spawn ripples and report input until it is gone
+    delete keyboard;
+    delete mouse;
+    delete ripples;
+    delete scheduler;
+    delete mirror;
+    delete canvas;
+    delete wave;
+    delete governor;
+
+    hid_exit();
+}
+
+// waveeffect [keyboard description], see devices/ for the built in one as a file
+int main(int argc, char** argv) {
+    DeviceDescription keyboardDescription = KeychronV6::builtin_description();
+
+    if(argc > 1) {
+        std::string error;
+        if(!DeviceDescription::load(argv[1], keyboardDescription, error) || !KeychronV6::accepts(keyboardDescription, error)) {
+            printf("%s: %s\n", argv[1], error.c_str());
+            return 1;
+        }
+    }
+
+    signal(SIGINT, onSIGINT);
+    signal(SIGUSR1, onSIGUSR1);
+
+    governor = new ActivityGovernor(IDLE_SECONDS, IDLE_FADE_SECONDS, BATTERY_FPS);
+
+    KeychronV6* keyboard = new KeychronV6(keyboardDescription);
+    Rival600* mouse = new Rival600();
+
+    keyboard->set_activity(governor);
+    mouse->set_activity(governor);
+
+    size_t maxKeyboardRows = 0;
+    for(size_t i = 0; i < keyboard->leds.size(); i++) {
+        if(keyboard->leds[i].size() > maxKeyboardRows) {
+            maxKeyboardRows = keyboard->leds[i].size();
+        }
+    }
+
+    startWave(maxKeyboardRows);
+
+    RippleEngine* ripples = new RippleEngine(keyboard->get_geometry(), { { 255, 255, 255 }, 200.0f, 20.0f, 1.0f });
+    keyboard->on_key_press([ripples](uint8_t led) -> void {
+        ripples->spawn(led);
+    });
+
+    const DeviceGeometry& keyboardGeometry = keyboard->get_geometry();
+    const DeviceGeometry& mouseGeometry = mouse->get_geometry();
+
+    float mouseX = keyboardGeometry.getWidth() + MOUSE_GAP_MM;
+    canvas = new CanvasBuffer(
+        CANVAS_WIDTH, CANVAS_HEIGHT,
+        mouseX + mouseGeometry.getWidth(), std::max(keyboardGeometry.getHeight(), mouseGeometry.getHeight())
+    );
+
+    CanvasSampler keyboardSampler(canvas->getLayout(), keyboardGeometry, 0.0f, 0.0f, CANVAS_SAMPLING);
+    CanvasSampler mouseSampler(canvas->getLayout(), mouseGeometry, mouseX, 0.0f, CANVAS_SAMPLING);
+
+    mirror = new FrameMirror();
+    mirror->create(FRAME_MIRROR, FRAME_MIRROR_OTHER_USERS ? 0644 : 0600);
+
+    CanvasRenderer canvasRenderer(keyboardGeometry);
+    MouseRenderer mouseRenderer(mouse, &mouseSampler, &canvasRenderer, mouseX);
+    SharedFrameRing* sharedFrames = new SharedFrameRing();
+    sharedFrames->create(KEYBOARD_SHARED_FRAMES, KeychronV6TotalLEDs);
+
+    std::vector<float> keyboardX(KeychronV6TotalLEDs);
+    std::vector<float> keyboardY(KeychronV6TotalLEDs);
+    for(size_t led = 0; led < KeychronV6TotalLEDs; led++) {
+        keyboardX[led] = keyboardGeometry.getX(led);
+        keyboardY[led] = keyboardGeometry.getY(led);
+    }
+
+    plugins = new EffectPluginHost(
+        keyboardX.data(), keyboardY.data(), KeychronV6TotalLEDs,
+        keyboardGeometry.getWidth(), keyboardGeometry.getHeight(), EFFECT_PLUGIN_BUDGET
+    );
+
+    plugins->start(effectPluginDirectory());
+
+    KeyboardRenderer* keyboardRenderer = new KeyboardRenderer(keyboard, ripples, &keyboardSampler, sharedFrames);
+
+    // each device gets its own thread so the mouse's slow feature reports never hold up the keyboard.
+    // the canvas is drawn once a frame and every device samples it.
+    // the devices draw for when their frames will show, so both show the same part of the wave
+    scheduler = new RenderScheduler();
+    scheduler->set_governor(governor);
+    scheduler->add("Canvas", nullptr, KEYBOARD_FPS, [&canvasRenderer](double time) -> bool {
+        canvasRenderer.render(time);
+        return true;
+    });
+
+    scheduler->add("Keychron V6", keyboard, KEYBOARD_FPS, [keyboardRenderer](double time) -> bool {
+        return keyboardRenderer->render(time);
+    });
+
+    scheduler->add("Rival 600", mouse, MOUSE_FPS, [&mouseRenderer](double time) -> bool {
+        return mouseRenderer.render(time);
+    });
+
+    // a command counts as input, and wakes the main thread to apply it
+    controls = new Controls(parseControl, []() -> void {
+        governor->input();
+
+        std::lock_guard<std::mutex> lock(controlMutex);
+        controlsQueued = true;
+        controlCondition.notify_one();
+    });
+    controls->start(controlSocketPath());
+
+    scheduler->start();
+
+    std::thread virtCheckerThread([](KeychronV6* keyboard) -> void {
+        VirtConnection con = VirtConnection("qemu:///system");
+        bool firstWithoutDomain = true;
+        
+        while(running) {
+            std::string vm;
+            {
+                std::lock_guard<std::mutex> lock(vmMutex);
+                vm = vmName;
+            }
+
+            if(!VirtUtils::hasVM(con, vm.c_str())) {
+                if(firstWithoutDomain) {
+                    printf("%s vm not found.\n", vm.c_str());
+                    firstWithoutDomain = false;
+                    
+                    keyboard->unset_custom_led(14);
+                }
+                
+                std::this_thread::sleep_for(std::chrono::milliseconds(10000));
+                continue;
+            }
+
+            firstWithoutDomain = true;
+            bool isOn = VirtUtils::VirtualMachineOn(con, vm.c_str());
+
+            if(keyboard->keypressStartTimes.find(KEY_RIGHTALT) != keyboard->keypressStartTimes.end()) {
+                if(time(NULL) - keyboard->keypressStartTimes[KEY_RIGHTALT] > 3) {
+                    VirtUtils::toggleVM(con, vm.c_str());
+
+                    // stop vm from being toggled until a repress
+                    auto it = keyboard->keypressStartTimes.find(KEY_RIGHTALT);
+                    // stop race condition
+                    if(it != keyboard->keypressStartTimes.end()) {
+                        keyboard->keypressStartTimes.erase(it);
+                    }
+                }
+            }
+
+            if(isOn) {
+                keyboard->unset_custom_led(14);
+            }
+            else {
+                keyboard->set_custom_led(14, { 69, 3, 1 });
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            firstWithoutDomain = true;
+        }
+    }, keyboard);
+
+    while(running) {
+        governor->refresh_battery();
+
+        if(printLinkHealth) {
+            printLinkHealth = 0;
+
+            printDeviceHealth("Keychron V6", keyboard);
+            printDeviceHealth("Rival 600", mouse);
+            printSharedFrames("Keychron V6", sharedFrames);
+            scheduler->printStats();
+            governor->printStats();
+            plugins->request_stats();
+
+            printf("Control: %zu batches, %zu commands, %zu rejected\n", controls->get_batches(), controls->get_commands(), controls->get_rejected());
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(controlMutex);
+            controlCondition.wait_for(lock, std::chrono::milliseconds(100), []() -> bool { return controlsQueued; });
+
+            controlsQueued = false;
+        }
+
+        std::vector<Controls::Batch> batches;
+        if(controls->take(batches)) applyControls(batches, keyboard, keyboardRenderer, &mouseRenderer);
+    }
+
+    cleanup(keyboard, mouse, ripples, keyboardRenderer, sharedFrames, &virtCheckerThread);
+
+    return 0;
+}